@@ -0,0 +1,2248 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra -pthread -c minivsfs.c
+#define _FILE_OFFSET_BITS 64
+#define _GNU_SOURCE // fallocate
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include "minivsfs.h"
+
+// ---- instrumentation: every hook is a single predictable branch while disabled ----
+enum
+{
+    PHASE_OPEN,
+    PHASE_FORMAT,
+    PHASE_ADD,
+    PHASE_REMOVE,
+    PHASE_REPLACE,
+    PHASE_CHECK,
+    PHASE_COMMIT,
+    PHASE_DEFRAG,
+    PHASE_RESIZE,
+    PHASE_DIFF,
+    PHASE_APPLY,
+    PHASE_COUNT
+};
+_Static_assert(PHASE_COUNT == MINIVSFS_PHASES, "phase table mismatch");
+static const char *const PHASE_NAMES[PHASE_COUNT] = {"open",   "format", "add",    "remove", "replace", "check",
+                                                          "commit", "defrag", "resize", "diff",   "apply"};
+
+static int g_stats_on;
+static int g_trace_on;
+static char *g_stats_format; // from --stats: "human" or "json"; NULL = no report
+static int g_trace_opt;      // from --trace
+static uint64_t g_phase_ns[PHASE_COUNT];
+static uint64_t g_phase_calls[PHASE_COUNT];
+static minivsfs_stats_t g_stats;
+
+#define STAT_ADD(field, n)                                                           \
+    do                                                                               \
+    {                                                                                \
+        if (__builtin_expect(g_stats_on, 0))                                         \
+            __atomic_fetch_add(&g_stats.field, (uint64_t)(n), __ATOMIC_RELAXED);     \
+    } while (0)
+
+struct minivsfs
+{
+    char *path;
+    uint8_t *image;
+    uint64_t image_size;
+    superblock_t *sb;
+
+    // live allocation state, folded back into the superblock by minivsfs_commit
+    uint64_t free_blocks;
+    uint64_t free_inodes;
+    uint32_t group_free_blocks[GROUPS_MAX];
+    uint32_t group_free_inodes[GROUPS_MAX];
+    uint16_t free_run_max[FREE_RUN_SLICES_MAX];
+
+    pthread_mutex_t slice_lock[FREE_RUN_SLICES_MAX]; // a data bitmap shard and its free_run_max
+    pthread_mutex_t dir_lock;                        // root directory block and root inode
+};
+
+// ==========================DO NOT CHANGE THIS PORTION=========================
+// These functions are there for your help. You should refer to the specifications to see how you can use them.
+// ====================================CRC32====================================
+static uint32_t CRC32_TAB[256];
+static void crc32_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for (int j = 0; j < 8; j++)
+            c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+        CRC32_TAB[i] = c;
+    }
+}
+static uint32_t crc32(const void *data, size_t n)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t c = 0xFFFFFFFFu;
+    for (size_t i = 0; i < n; i++)
+        c = CRC32_TAB[(c ^ p[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+// ====================================CRC32====================================
+
+// the template's table and crc32 stay private so a host linking zlib sees no clash;
+// the table is filled once, whichever thread gets here first
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+uint32_t minivsfs_crc32(const void *data, size_t n)
+{
+    pthread_once(&crc32_once, crc32_init);
+    return crc32(data, n);
+}
+
+// WARNING: CALL THIS ONLY AFTER ALL OTHER SUPERBLOCK ELEMENTS HAVE BEEN FINALIZED
+// sb must point at a full BS-sized block
+uint32_t superblock_crc_finalize(superblock_t *sb)
+{
+    STAT_ADD(crc_bytes, BS - 4);
+    sb->checksum = 0;
+    uint32_t s = minivsfs_crc32((void *)sb, BS - 4);
+    sb->checksum = s;
+    return s;
+}
+
+// WARNING: CALL THIS ONLY AFTER ALL OTHER SUPERBLOCK ELEMENTS HAVE BEEN FINALIZED
+void inode_crc_finalize(inode_t *ino)
+{
+    uint8_t tmp[INODE_SIZE];
+    STAT_ADD(crc_bytes, 120);
+    memcpy(tmp, ino, INODE_SIZE);
+    // zero crc area before computing
+    memset(&tmp[120], 0, 8);
+    uint32_t c = minivsfs_crc32(tmp, 120);
+    ino->inode_crc = (uint64_t)c; // low 4 bytes carry the crc
+}
+
+// WARNING: CALL THIS ONLY AFTER ALL OTHER SUPERBLOCK ELEMENTS HAVE BEEN FINALIZED
+void dirent_checksum_finalize(dirent64_t *de)
+{
+    const uint8_t *p = (const uint8_t *)de;
+    uint8_t x = 0;
+    for (int i = 0; i < 63; i++)
+        x ^= p[i]; // covers ino(4) + type(1) + name(58)
+    de->checksum = x;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint64_t phase_begin(void)
+{
+    return __builtin_expect(g_stats_on, 0) ? now_ns() : 0;
+}
+
+static void phase_end(int phase, uint64_t t0, const char *detail)
+{
+    if (__builtin_expect(!g_stats_on, 1))
+        return;
+
+    uint64_t dt = now_ns() - t0;
+    __atomic_fetch_add(&g_phase_ns[phase], dt, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&g_phase_calls[phase], 1, __ATOMIC_RELAXED);
+    if (g_trace_on)
+        fprintf(stderr, "[trace] %-7s %10.3f ms  %s\n", PHASE_NAMES[phase], dt / 1e6, detail ? detail : "");
+}
+
+void minivsfs_stats_enable(int trace)
+{
+    g_stats_on = 1;
+    g_trace_on = trace;
+}
+
+void minivsfs_stats_get(minivsfs_stats_t *out)
+{
+    *out = g_stats;
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        out->phase_ns[p] = g_phase_ns[p];
+        out->phase_calls[p] = g_phase_calls[p];
+    }
+
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+        out->peak_rss_kib = ru.ru_maxrss; // KiB on Linux
+}
+
+void minivsfs_stats_report(FILE *out, int json)
+{
+    minivsfs_stats_t st;
+    minivsfs_stats_get(&st);
+
+    if (json)
+    {
+        fprintf(out, "{\"phases\": {");
+        for (int p = 0; p < PHASE_COUNT; p++)
+            fprintf(out, "%s\"%s\": {\"calls\": %lu, \"ms\": %.3f}", p ? ", " : "", PHASE_NAMES[p],
+                    st.phase_calls[p], st.phase_ns[p] / 1e6);
+        fprintf(out,
+                "}, \"bitmap_bits_scanned\": %lu, \"crc_bytes\": %lu, \"data_bytes_copied\": %lu, "
+                "\"syscalls\": %lu, \"peak_rss_kib\": %lu}\n",
+                st.bitmap_bits_scanned, st.crc_bytes, st.data_bytes_copied, st.syscalls, st.peak_rss_kib);
+        return;
+    }
+
+    fprintf(out, "Stats:\n");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        if (st.phase_calls[p])
+            fprintf(out, "  %-7s %6lu call(s) %10.3f ms\n", PHASE_NAMES[p], st.phase_calls[p], st.phase_ns[p] / 1e6);
+    }
+    fprintf(out, "  bitmap bits scanned: %lu\n", st.bitmap_bits_scanned);
+    fprintf(out, "  crc bytes:           %lu\n", st.crc_bytes);
+    fprintf(out, "  data bytes copied:   %lu\n", st.data_bytes_copied);
+    fprintf(out, "  syscalls:            %lu\n", st.syscalls);
+    fprintf(out, "  peak memory:         %lu KiB\n", st.peak_rss_kib);
+}
+
+// registered by minivsfs_parse_opts, so the report asked for with --stats comes out on
+// every exit, failed runs included
+static void print_requested_stats(void)
+{
+    minivsfs_stats_report(stdout, strcmp(g_stats_format, "json") == 0);
+}
+
+const char *minivsfs_strerror(int err)
+{
+    switch (err < 0 ? -err : err)
+    {
+    case MINIVSFS_OK:
+        return "Success";
+    case MINIVSFS_EIO:
+        return "Image I/O failed";
+    case MINIVSFS_ENOMEM:
+        return "Cannot allocate memory for image";
+    case MINIVSFS_EBADFS:
+        return "Invalid file system magic number";
+    case MINIVSFS_ENOINODE:
+        return "No free inodes available";
+    case MINIVSFS_ENOSPC:
+        return "Not enough free data blocks";
+    case MINIVSFS_EDIRFULL:
+        return "Root directory is full";
+    case MINIVSFS_ENAMETOOLONG:
+        return "Filename too long (max 57 characters)";
+    case MINIVSFS_EFBIG:
+        return "File too large";
+    case MINIVSFS_ENOENT:
+        return "No such file";
+    case MINIVSFS_EINVAL:
+        return "Invalid argument or image geometry";
+    case MINIVSFS_ESTALE:
+        return "Image is not the base the delta was made from";
+    }
+    return "Unknown error";
+}
+
+// ---- file I/O: every call that reaches the kernel goes through here and is counted ----
+static int io_open(const char *path, int flags)
+{
+    STAT_ADD(syscalls, 1);
+    return open(path, flags, 0666);
+}
+
+static int io_close(int fd)
+{
+    STAT_ADD(syscalls, 1);
+    return close(fd);
+}
+
+static int io_size(int fd, uint64_t *size_out)
+{
+    struct stat st;
+    STAT_ADD(syscalls, 1);
+    if (fstat(fd, &st) != 0)
+        return -1;
+    *size_out = (uint64_t)st.st_size;
+    return 0;
+}
+
+// whole transfers only: short reads and writes are continued, running out of file is an error
+static int io_read(int fd, void *buf, uint64_t n, uint64_t offset)
+{
+    uint8_t *p = buf;
+    while (n > 0)
+    {
+        ssize_t done = pread(fd, p, n, (off_t)offset);
+        STAT_ADD(syscalls, 1);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return -1;
+        p += done;
+        n -= done;
+        offset += done;
+    }
+    return 0;
+}
+
+static int io_write(int fd, const void *buf, uint64_t n, uint64_t offset)
+{
+    const uint8_t *p = buf;
+    while (n > 0)
+    {
+        ssize_t done = pwrite(fd, p, n, (off_t)offset);
+        STAT_ADD(syscalls, 1);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return -1;
+        p += done;
+        n -= done;
+        offset += done;
+    }
+    return 0;
+}
+
+static int io_truncate(int fd, uint64_t size)
+{
+    STAT_ADD(syscalls, 1);
+    return ftruncate(fd, (off_t)size);
+}
+
+// deallocates a range, keeping the file size; fails where holes are not supported
+static int io_punch(int fd, uint64_t offset, uint64_t n)
+{
+    STAT_ADD(syscalls, 1);
+    return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)offset, (off_t)n);
+}
+
+// ---- bitmaps ----
+static int test_bit(const uint8_t *bitmap, uint64_t bit_pos)
+{
+    return (bitmap[bit_pos / 8] >> (bit_pos % 8)) & 1;
+}
+
+static void set_bit(uint8_t *bitmap, uint64_t bit_pos)
+{
+    bitmap[bit_pos / 8] |= (1 << (bit_pos % 8));
+}
+
+static void clear_bit(uint8_t *bitmap, uint64_t bit_pos)
+{
+    bitmap[bit_pos / 8] &= ~(1 << (bit_pos % 8));
+}
+
+static uint64_t count_free_bits(const uint8_t *bitmap, uint64_t max_bits)
+{
+    uint64_t n = 0;
+    STAT_ADD(bitmap_bits_scanned, max_bits);
+    for (uint64_t i = 0; i < max_bits; i++)
+    {
+        if (!test_bit(bitmap, i))
+            n++;
+    }
+    return n;
+}
+
+// largest run of clear bits in [start, end)
+static uint16_t largest_free_run(const uint8_t *bitmap, uint64_t start, uint64_t end)
+{
+    uint16_t best = 0, run = 0;
+    STAT_ADD(bitmap_bits_scanned, end - start);
+    for (uint64_t i = start; i < end; i++)
+    {
+        if (test_bit(bitmap, i))
+        {
+            run = 0;
+            continue;
+        }
+        if (++run > best)
+            best = run;
+    }
+    return best;
+}
+
+// first clear bit, set atomically so concurrent callers never claim the same one
+static int64_t claim_free_bit(uint8_t *bitmap, uint64_t max_bits)
+{
+    for (uint64_t byte_idx = 0; byte_idx < (max_bits + 7) / 8; byte_idx++)
+    {
+        uint8_t cur = __atomic_load_n(&bitmap[byte_idx], __ATOMIC_RELAXED);
+        for (int bit_idx = 0; cur != 0xFF && bit_idx < 8; bit_idx++)
+        {
+            uint64_t bit_pos = byte_idx * 8 + bit_idx;
+            uint8_t mask = 1 << bit_idx;
+            if (bit_pos >= max_bits)
+                break;
+            if (cur & mask)
+                continue;
+            cur = __atomic_fetch_or(&bitmap[byte_idx], mask, __ATOMIC_ACQ_REL);
+            if (!(cur & mask))
+            {
+                STAT_ADD(bitmap_bits_scanned, bit_pos + 1);
+                return (int64_t)bit_pos;
+            }
+            cur |= mask;
+        }
+    }
+    STAT_ADD(bitmap_bits_scanned, max_bits);
+    return -1;
+}
+
+// takes n from a counter unless it would go negative
+static int reserve(uint32_t *counter, uint32_t n)
+{
+    uint32_t cur = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    while (cur >= n)
+    {
+        if (__atomic_compare_exchange_n(counter, &cur, cur - n, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return 1;
+    }
+    return 0;
+}
+
+// ---- block-group layout: group g is group 0 shifted by g * blocks_per_group ----
+static uint64_t group_inode_bitmap_block(const superblock_t *sb, uint32_t g)
+{
+    return sb->inode_bitmap_start + (uint64_t)g * sb->blocks_per_group;
+}
+
+static uint64_t group_data_bitmap_block(const superblock_t *sb, uint32_t g)
+{
+    return sb->data_bitmap_start + (uint64_t)g * sb->blocks_per_group;
+}
+
+static uint64_t group_inode_table_block(const superblock_t *sb, uint32_t g)
+{
+    return sb->inode_table_start + (uint64_t)g * sb->blocks_per_group;
+}
+
+static uint64_t group_data_start(const superblock_t *sb, uint32_t g)
+{
+    return sb->data_region_start + (uint64_t)g * sb->blocks_per_group;
+}
+
+// the last group also owns the blocks left over by the division
+static uint64_t group_data_blocks(const superblock_t *sb, uint32_t g)
+{
+    uint64_t end = (g + 1 < sb->group_count) ? group_inode_bitmap_block(sb, g + 1) : sb->total_blocks;
+    return end - group_data_start(sb, g);
+}
+
+static uint32_t block_group(const superblock_t *sb, uint64_t block)
+{
+    uint64_t g = (block - sb->inode_bitmap_start) / sb->blocks_per_group;
+    return g < sb->group_count ? (uint32_t)g : sb->group_count - 1;
+}
+
+static inode_t *inode_at(minivsfs_t *fs, uint64_t ino)
+{
+    uint32_t g = (ino - 1) / fs->sb->inodes_per_group;
+    inode_t *table = (inode_t *)(fs->image + group_inode_table_block(fs->sb, g) * BS);
+    return &table[(ino - 1) % fs->sb->inodes_per_group];
+}
+
+static uint8_t *data_bitmap(minivsfs_t *fs, uint32_t g)
+{
+    return fs->image + group_data_bitmap_block(fs->sb, g) * BS;
+}
+
+static uint64_t slice_end(const superblock_t *sb, uint32_t g, uint32_t slice)
+{
+    uint64_t end = (uint64_t)(slice + 1) * FREE_RUN_SLICE;
+    uint64_t blocks = group_data_blocks(sb, g);
+    return end < blocks ? end : blocks;
+}
+
+// caller holds the slice lock (or is the only thread)
+static void update_free_run_slice(minivsfs_t *fs, uint32_t g, uint32_t slice)
+{
+    uint16_t run = largest_free_run(data_bitmap(fs, g), (uint64_t)slice * FREE_RUN_SLICE,
+                                    slice_end(fs->sb, g, slice));
+    __atomic_store_n(&fs->free_run_max[g * fs->sb->slices_per_group + slice], run, __ATOMIC_RELAXED);
+}
+
+// summary slots per group, sized by the largest group (a truncated last group may be the smallest)
+static uint64_t summary_slices_per_group(const superblock_t *sb)
+{
+    uint64_t max_group_blocks = 0;
+    for (uint32_t g = 0; g < sb->group_count; g++)
+    {
+        if (group_data_blocks(sb, g) > max_group_blocks)
+            max_group_blocks = group_data_blocks(sb, g);
+    }
+    return (max_group_blocks + FREE_RUN_SLICE - 1) / FREE_RUN_SLICE;
+}
+
+// recompute counts and summary from the bitmaps (older images carry none)
+static void rebuild_free_space_summary(minivsfs_t *fs)
+{
+    superblock_t *sb = fs->sb;
+    sb->slices_per_group = summary_slices_per_group(sb);
+    sb->free_run_slices = sb->group_count * sb->slices_per_group;
+    fs->free_blocks = 0;
+    fs->free_inodes = 0;
+    memset(fs->free_run_max, 0, sizeof(fs->free_run_max));
+
+    for (uint32_t g = 0; g < sb->group_count; g++)
+    {
+        uint64_t blocks = group_data_blocks(sb, g);
+        fs->group_free_blocks[g] = count_free_bits(data_bitmap(fs, g), blocks);
+        fs->group_free_inodes[g] = count_free_bits(fs->image + group_inode_bitmap_block(sb, g) * BS,
+                                                   sb->inodes_per_group);
+        fs->free_blocks += fs->group_free_blocks[g];
+        fs->free_inodes += fs->group_free_inodes[g];
+
+        for (uint32_t s = 0; s * FREE_RUN_SLICE < blocks; s++)
+            update_free_run_slice(fs, g, s);
+    }
+}
+
+// ---- allocation ----
+
+// children go to their parent's group; spill to the next group with room for both
+// the inode and its data, then to any group with a free inode
+static int64_t alloc_inode(minivsfs_t *fs, uint32_t parent_group, uint64_t blocks_needed, uint32_t *group_out)
+{
+    const superblock_t *sb = fs->sb;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (uint32_t i = 0; i < sb->group_count; i++)
+        {
+            uint32_t g = (parent_group + i) % sb->group_count;
+            if (pass == 0 && __atomic_load_n(&fs->group_free_blocks[g], __ATOMIC_RELAXED) < blocks_needed)
+                continue;
+            if (!reserve(&fs->group_free_inodes[g], 1))
+                continue;
+
+            int64_t idx = claim_free_bit(fs->image + group_inode_bitmap_block(sb, g) * BS, sb->inodes_per_group);
+            if (idx < 0) // counter and bitmap disagree; should not happen
+            {
+                __atomic_fetch_add(&fs->group_free_inodes[g], 1, __ATOMIC_RELAXED);
+                continue;
+            }
+            __atomic_fetch_sub(&fs->free_inodes, 1, __ATOMIC_RELAXED);
+            *group_out = g;
+            return (int64_t)g * sb->inodes_per_group + idx + 1;
+        }
+    }
+    return -1;
+}
+
+static void release_inode(minivsfs_t *fs, uint64_t ino)
+{
+    uint32_t g = (ino - 1) / fs->sb->inodes_per_group;
+    uint64_t idx = (ino - 1) % fs->sb->inodes_per_group;
+    uint8_t *bitmap = fs->image + group_inode_bitmap_block(fs->sb, g) * BS;
+
+    __atomic_fetch_and(&bitmap[idx / 8], (uint8_t) ~(1 << (idx % 8)), __ATOMIC_ACQ_REL);
+    __atomic_fetch_add(&fs->group_free_inodes[g], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&fs->free_inodes, 1, __ATOMIC_RELAXED);
+}
+
+static void account_blocks(minivsfs_t *fs, uint32_t g, int64_t delta)
+{
+    __atomic_fetch_add(&fs->group_free_blocks[g], (uint32_t)delta, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&fs->free_blocks, (uint64_t)delta, __ATOMIC_RELAXED);
+}
+
+static void release_blocks(minivsfs_t *fs, const uint32_t *blocks, int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        uint32_t g = block_group(fs->sb, blocks[i]);
+        uint64_t idx = blocks[i] - group_data_start(fs->sb, g);
+        uint32_t slice = idx / FREE_RUN_SLICE;
+        pthread_mutex_t *lock = &fs->slice_lock[g * fs->sb->slices_per_group + slice];
+
+        pthread_mutex_lock(lock);
+        clear_bit(data_bitmap(fs, g), idx);
+        update_free_run_slice(fs, g, slice);
+        pthread_mutex_unlock(lock);
+        account_blocks(fs, g, 1);
+    }
+}
+
+// like release_blocks, but the contents are dropped too: the blocks are zeroed in memory
+// to match the hole commit leaves for them in the backing file
+static void discard_blocks(minivsfs_t *fs, const uint32_t *blocks, int n)
+{
+    for (int i = 0; i < n; i++)
+        memset(fs->image + (uint64_t)blocks[i] * BS, 0, BS);
+    release_blocks(fs, blocks, n);
+}
+
+// first-fit contiguous run of n blocks in group g, skipping slices whose largest run is
+// too short; busy slices are passed over once and revisited so writers spread out.
+// Returns the first block number of the claimed run or 0
+static uint64_t alloc_run(minivsfs_t *fs, uint32_t g, uint64_t n)
+{
+    const superblock_t *sb = fs->sb;
+    uint8_t *bitmap = data_bitmap(fs, g);
+
+    if (__atomic_load_n(&fs->group_free_blocks[g], __ATOMIC_RELAXED) < n)
+        return 0;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (uint32_t s = 0; s < sb->slices_per_group; s++)
+        {
+            uint32_t slot = g * sb->slices_per_group + s;
+            if (__atomic_load_n(&fs->free_run_max[slot], __ATOMIC_RELAXED) < n)
+                continue;
+            if (pass == 0 ? pthread_mutex_trylock(&fs->slice_lock[slot]) != 0
+                          : pthread_mutex_lock(&fs->slice_lock[slot]) != 0)
+                continue;
+
+            uint64_t run = 0, start = 0, i;
+            for (i = (uint64_t)s * FREE_RUN_SLICE; i < slice_end(sb, g, s); i++)
+            {
+                run = test_bit(bitmap, i) ? 0 : run + 1;
+                if (run == n)
+                {
+                    start = i + 1 - n;
+                    break;
+                }
+            }
+            STAT_ADD(bitmap_bits_scanned, i - (uint64_t)s * FREE_RUN_SLICE);
+            if (run == n)
+            {
+                for (uint64_t b = 0; b < n; b++)
+                    set_bit(bitmap, start + b);
+                update_free_run_slice(fs, g, s);
+            }
+            pthread_mutex_unlock(&fs->slice_lock[slot]);
+
+            if (run == n)
+            {
+                account_blocks(fs, g, -(int64_t)n);
+                return group_data_start(sb, g) + start;
+            }
+        }
+    }
+    return 0;
+}
+
+// first-fit scattered allocation in group g over slices that still have free blocks;
+// appends to out[] and returns the new count
+static int alloc_scattered(minivsfs_t *fs, uint32_t g, uint64_t n, uint32_t *out, int found)
+{
+    const superblock_t *sb = fs->sb;
+    uint8_t *bitmap = data_bitmap(fs, g);
+
+    for (uint32_t s = 0; s < sb->slices_per_group && found < (int)n; s++)
+    {
+        uint32_t slot = g * sb->slices_per_group + s;
+        if (__atomic_load_n(&fs->free_run_max[slot], __ATOMIC_RELAXED) == 0)
+            continue;
+
+        int taken = 0;
+        uint64_t i;
+        pthread_mutex_lock(&fs->slice_lock[slot]);
+        for (i = (uint64_t)s * FREE_RUN_SLICE; i < slice_end(sb, g, s) && found < (int)n; i++)
+        {
+            if (!test_bit(bitmap, i))
+            {
+                set_bit(bitmap, i);
+                out[found++] = group_data_start(sb, g) + i;
+                taken++;
+            }
+        }
+        STAT_ADD(bitmap_bits_scanned, i - (uint64_t)s * FREE_RUN_SLICE);
+        if (taken)
+            update_free_run_slice(fs, g, s);
+        pthread_mutex_unlock(&fs->slice_lock[slot]);
+        account_blocks(fs, g, -taken);
+    }
+    return found;
+}
+
+// data follows the inode: a run in its own group, else any of its free blocks,
+// else a run elsewhere, else scattered blocks starting from its group.
+// Returns n, or releases what it took and returns -1
+static int alloc_data_blocks(minivsfs_t *fs, uint32_t home, uint64_t n, uint32_t *out)
+{
+    const superblock_t *sb = fs->sb;
+
+    if (n == 0)
+        return 0;
+
+    uint64_t run = alloc_run(fs, home, n);
+    for (uint32_t i = 1; !run && i < sb->group_count; i++)
+    {
+        if (i == 1 && __atomic_load_n(&fs->group_free_blocks[home], __ATOMIC_RELAXED) >= n)
+            break;
+        run = alloc_run(fs, (home + i) % sb->group_count, n);
+    }
+    if (run)
+    {
+        for (uint64_t b = 0; b < n; b++)
+            out[b] = run + b;
+        return (int)n;
+    }
+
+    int found = 0;
+    for (uint32_t i = 0; i < sb->group_count && found < (int)n; i++)
+        found = alloc_scattered(fs, (home + i) % sb->group_count, n, out, found);
+    if (found < (int)n)
+    {
+        release_blocks(fs, out, found);
+        return -1;
+    }
+    return found;
+}
+
+// empties an inode slot but keeps its generation, so whatever goes in next gets a new one
+static void clear_inode(inode_t *inode)
+{
+    uint32_t generation = inode->generation;
+    memset(inode, 0, sizeof(inode_t));
+    inode->generation = generation;
+}
+
+// ---- root directory ----
+// caller holds dir_lock
+static dirent64_t *dir_find(minivsfs_t *fs, const char *name)
+{
+    inode_t *root_inode = inode_at(fs, ROOT_INO);
+    dirent64_t *root_entries = (dirent64_t *)(fs->image + (uint64_t)root_inode->direct[0] * BS);
+    int entries_per_block = BS / sizeof(dirent64_t);
+
+    for (int i = 0; i < entries_per_block; i++)
+    {
+        if (root_entries[i].inode_no != 0 &&
+            strncmp(root_entries[i].name, name, sizeof(root_entries[i].name)) == 0)
+            return &root_entries[i];
+    }
+    return NULL;
+}
+
+static int dir_insert(minivsfs_t *fs, const char *name, uint64_t ino, time_t now)
+{
+    int rc = -MINIVSFS_EDIRFULL;
+
+    pthread_mutex_lock(&fs->dir_lock);
+    inode_t *root_inode = inode_at(fs, ROOT_INO);
+    dirent64_t *root_entries = (dirent64_t *)(fs->image + (uint64_t)root_inode->direct[0] * BS);
+    int entries_per_block = BS / sizeof(dirent64_t);
+
+    for (int i = 0; i < entries_per_block; i++)
+    {
+        if (root_entries[i].inode_no != 0)
+            continue;
+
+        dirent64_t *new_entry = &root_entries[i];
+        memset(new_entry, 0, sizeof(dirent64_t));
+        new_entry->inode_no = ino;
+        new_entry->type = FILE_TYPE_FILE;
+        strcpy(new_entry->name, name);
+        dirent_checksum_finalize(new_entry);
+
+        root_inode->size_bytes += sizeof(dirent64_t);
+        root_inode->links++;
+        root_inode->mtime = now;
+        root_inode->ctime = now;
+        inode_crc_finalize(root_inode);
+        rc = MINIVSFS_OK;
+        break;
+    }
+    pthread_mutex_unlock(&fs->dir_lock);
+    return rc;
+}
+
+// ---- public API ----
+static void init_locks(minivsfs_t *fs)
+{
+    for (uint32_t i = 0; i < FREE_RUN_SLICES_MAX; i++)
+        pthread_mutex_init(&fs->slice_lock[i], NULL);
+    pthread_mutex_init(&fs->dir_lock, NULL);
+}
+
+static void load_free_space_summary(minivsfs_t *fs)
+{
+    const superblock_t *sb = fs->sb;
+
+    fs->free_blocks = sb->free_blocks_count;
+    fs->free_inodes = sb->free_inodes_count;
+    memcpy(fs->group_free_blocks, sb->group_free_blocks, sizeof(fs->group_free_blocks));
+    memcpy(fs->group_free_inodes, sb->group_free_inodes, sizeof(fs->group_free_inodes));
+    memcpy(fs->free_run_max, sb->free_run_max, sizeof(fs->free_run_max));
+}
+
+// the superblock on disk only changes here; counters are otherwise live in the handle
+static void store_free_space_summary(minivsfs_t *fs)
+{
+    superblock_t *sb = fs->sb;
+
+    sb->free_blocks_count = fs->free_blocks;
+    sb->free_inodes_count = fs->free_inodes;
+    memcpy(sb->group_free_blocks, fs->group_free_blocks, sizeof(fs->group_free_blocks));
+    memcpy(sb->group_free_inodes, fs->group_free_inodes, sizeof(fs->group_free_inodes));
+    memcpy(sb->free_run_max, fs->free_run_max, sizeof(fs->free_run_max));
+}
+
+// group 0 starts at block 1 and every group is laid out as
+// [inode bitmap][data bitmap][inode table slice][data], so groups == 1 is the flat layout
+// every group needs data blocks, its data bitmap is one block, and the summary has a
+// fixed number of slots
+static int check_geometry(const superblock_t *sb)
+{
+    if (sb->group_count < 1 || sb->group_count > GROUPS_MAX ||
+        (sb->group_count > 1 && sb->blocks_per_group > sb->total_blocks) ||
+        sb->inodes_per_group < 1 || sb->inodes_per_group > BS * 8 ||
+        sb->inode_count != sb->inodes_per_group * sb->group_count || sb->inode_bitmap_start < 1 ||
+        sb->data_bitmap_start <= sb->inode_bitmap_start || sb->inode_table_start <= sb->data_bitmap_start ||
+        sb->inode_table_start + (sb->inodes_per_group * INODE_SIZE + BS - 1) / BS > sb->data_region_start)
+        return -MINIVSFS_EINVAL;
+
+    for (uint32_t g = 0; g < sb->group_count; g++)
+    {
+        if (group_data_start(sb, g) >= sb->total_blocks)
+            return -MINIVSFS_EINVAL;
+        uint64_t blocks = group_data_blocks(sb, g);
+        if (blocks < 1 || blocks > BS * 8)
+            return -MINIVSFS_EINVAL;
+    }
+    if (sb->group_count * summary_slices_per_group(sb) > FREE_RUN_SLICES_MAX)
+        return -MINIVSFS_EINVAL;
+    return MINIVSFS_OK;
+}
+
+// the stored summary is only as good as the checksum vouching for it, and its shape
+// must match the geometry before it can index the per-slice arrays
+static int summary_trusted(superblock_t *sb)
+{
+    uint32_t stored = sb->checksum;
+    int crc_ok = superblock_crc_finalize(sb) == stored;
+    sb->checksum = stored;
+    return crc_ok && sb->slices_per_group == summary_slices_per_group(sb) &&
+           sb->free_run_slices == sb->group_count * sb->slices_per_group;
+}
+
+static int load_image(const char *path, minivsfs_t **out)
+{
+    int fd = io_open(path, O_RDONLY);
+    if (fd < 0)
+        return -MINIVSFS_EIO;
+
+    uint64_t img_size;
+    if (io_size(fd, &img_size) != 0)
+    {
+        io_close(fd);
+        return -MINIVSFS_EIO;
+    }
+    if (img_size < BS)
+    {
+        io_close(fd);
+        return -MINIVSFS_EBADFS;
+    }
+
+    minivsfs_t *fs = calloc(1, sizeof(minivsfs_t));
+    uint8_t *image_data = malloc(img_size);
+    char *path_copy = strdup(path);
+    int rc = -MINIVSFS_ENOMEM;
+    if (fs && image_data && path_copy)
+        rc = io_read(fd, image_data, img_size, 0) == 0 ? MINIVSFS_OK : -MINIVSFS_EIO;
+    io_close(fd);
+    if (rc != MINIVSFS_OK)
+    {
+        free(fs);
+        free(image_data);
+        free(path_copy);
+        return rc;
+    }
+
+    fs->path = path_copy;
+    fs->image = image_data;
+    fs->image_size = img_size;
+    fs->sb = (superblock_t *)image_data;
+
+    superblock_t *sb = fs->sb;
+    if (sb->magic != FS_MAGIC || sb->total_blocks > img_size / BS)
+    {
+        minivsfs_close(fs);
+        return -MINIVSFS_EBADFS;
+    }
+
+    if (sb->version < FS_VERSION)
+    {
+        // upgrade in place: older images are a single group and carry no summary
+        memset(&sb->group_count, 0, sizeof(superblock_t) - offsetof(superblock_t, group_count));
+        sb->group_count = 1;
+        sb->blocks_per_group = sb->total_blocks - sb->inode_bitmap_start;
+        sb->inodes_per_group = sb->inode_count;
+        sb->version = FS_VERSION;
+    }
+
+    // the geometry locates every bitmap and table, so nothing can be recounted without it
+    if (check_geometry(sb) != MINIVSFS_OK)
+    {
+        minivsfs_close(fs);
+        return -MINIVSFS_EBADFS;
+    }
+    if (summary_trusted(sb))
+        load_free_space_summary(fs);
+    else
+        rebuild_free_space_summary(fs);
+
+    init_locks(fs);
+    *out = fs;
+    return MINIVSFS_OK;
+}
+
+int minivsfs_open(const char *path, minivsfs_t **out)
+{
+    *out = NULL;
+    uint64_t t0 = phase_begin();
+    int rc = load_image(path, out);
+    phase_end(PHASE_OPEN, t0, path);
+    return rc;
+}
+
+static int init_superblock(superblock_t *sb, uint64_t size_kib, uint64_t inode_count, uint32_t groups)
+{
+    if (groups < 1 || groups > GROUPS_MAX || inode_count < 1)
+        return -MINIVSFS_EINVAL;
+
+    uint64_t total_blocks = (size_kib * 1024) / BS;
+    uint64_t inodes_per_group = (inode_count + groups - 1) / groups;
+    if (groups > 1) // fill the last inode table block of every group
+        inodes_per_group = (inodes_per_group + BS / INODE_SIZE - 1) / (BS / INODE_SIZE) * (BS / INODE_SIZE);
+    uint64_t inode_table_blocks = (inodes_per_group * INODE_SIZE + BS - 1) / BS;
+    uint64_t overhead = 2 + inode_table_blocks;
+
+    if (inodes_per_group > BS * 8 || total_blocks < 1 + groups * (overhead + 1))
+        return -MINIVSFS_EINVAL;
+
+    sb->magic = FS_MAGIC;
+    sb->version = FS_VERSION;
+    sb->block_size = BS;
+    sb->total_blocks = total_blocks;
+    sb->inode_count = inodes_per_group * groups;
+    sb->inode_bitmap_start = 1;
+    sb->inode_bitmap_blocks = 1;
+    sb->data_bitmap_start = 2;
+    sb->data_bitmap_blocks = 1;
+    sb->inode_table_start = 3;
+    sb->inode_table_blocks = inode_table_blocks;
+    sb->data_region_start = 3 + inode_table_blocks;
+    sb->data_region_blocks = total_blocks - 1 - groups * overhead;
+    sb->root_inode = ROOT_INO;
+    sb->mtime_epoch = time(NULL);
+    sb->flags = (uint32_t)rand();
+    sb->group_count = groups;
+    sb->blocks_per_group = (total_blocks - 1) / groups;
+    sb->inodes_per_group = inodes_per_group;
+    return check_geometry(sb);
+}
+
+int minivsfs_format(uint64_t size_kib, uint64_t inode_count, uint32_t groups, minivsfs_t **out)
+{
+    *out = NULL;
+    uint64_t t0 = phase_begin();
+
+    superblock_t geometry;
+    memset(&geometry, 0, sizeof(geometry));
+    int rc = init_superblock(&geometry, size_kib, inode_count, groups);
+    if (rc != MINIVSFS_OK)
+        return rc;
+
+    minivsfs_t *fs = calloc(1, sizeof(minivsfs_t));
+    uint8_t *image_data = calloc(geometry.total_blocks, BS);
+    if (!fs || !image_data)
+    {
+        free(fs);
+        free(image_data);
+        return -MINIVSFS_ENOMEM;
+    }
+
+    fs->image = image_data;
+    fs->image_size = geometry.total_blocks * BS;
+    fs->sb = (superblock_t *)image_data;
+    memcpy(fs->sb, &geometry, sizeof(geometry));
+
+    superblock_t *sb = fs->sb;
+    time_t now = time(NULL);
+
+    // root dir inode
+    inode_t *root_ino = inode_at(fs, ROOT_INO);
+    root_ino->mode = MODE_DIR;
+    root_ino->links = 2;
+    root_ino->size_bytes = 2 * sizeof(dirent64_t); // . and .. entry
+    root_ino->atime = now;
+    root_ino->mtime = now;
+    root_ino->ctime = now;
+    root_ino->direct[0] = sb->data_region_start; // First data block point
+    root_ino->proj_id = 1;
+    inode_crc_finalize(root_ino);
+
+    dirent64_t *entries = (dirent64_t *)(image_data + sb->data_region_start * BS);
+    entries[0].inode_no = ROOT_INO;
+    entries[0].type = FILE_TYPE_DIR;
+    strcpy(entries[0].name, ".");
+    entries[1].inode_no = ROOT_INO;
+    entries[1].type = FILE_TYPE_DIR;
+    strcpy(entries[1].name, "..");
+    dirent_checksum_finalize(&entries[0]);
+    dirent_checksum_finalize(&entries[1]);
+
+    set_bit(image_data + sb->inode_bitmap_start * BS, 0);
+    set_bit(image_data + sb->data_bitmap_start * BS, 0);
+    rebuild_free_space_summary(fs);
+    store_free_space_summary(fs);
+
+    init_locks(fs);
+    *out = fs;
+    phase_end(PHASE_FORMAT, t0, NULL);
+    return MINIVSFS_OK;
+}
+
+int minivsfs_alloc(minivsfs_t *fs, uint64_t nblocks, uint64_t *ino_out, uint32_t *blocks)
+{
+    if (nblocks > DIRECT_MAX)
+        return -MINIVSFS_EFBIG;
+
+    // O(1) rejection from the free counters before touching any bitmap
+    if (__atomic_load_n(&fs->free_inodes, __ATOMIC_RELAXED) == 0)
+        return -MINIVSFS_ENOINODE;
+    if (__atomic_load_n(&fs->free_blocks, __ATOMIC_RELAXED) < nblocks)
+        return -MINIVSFS_ENOSPC;
+
+    uint32_t root_group = (ROOT_INO - 1) / fs->sb->inodes_per_group;
+    uint32_t inode_group;
+    int64_t ino = alloc_inode(fs, root_group, nblocks, &inode_group);
+    if (ino < 0)
+        return -MINIVSFS_ENOINODE;
+
+    if (alloc_data_blocks(fs, inode_group, nblocks, blocks) < 0)
+    {
+        release_inode(fs, ino);
+        return -MINIVSFS_ENOSPC;
+    }
+
+    *ino_out = ino;
+    return MINIVSFS_OK;
+}
+
+static int add_file(minivsfs_t *fs, const char *name, const void *data, uint64_t size, uint64_t *ino_out)
+{
+    if (name[0] == '\0' || strlen(name) >= sizeof(((dirent64_t *)0)->name))
+        return -MINIVSFS_ENAMETOOLONG;
+
+    uint64_t blocks_needed = (size + BS - 1) / BS;
+    uint32_t blocks[DIRECT_MAX];
+    uint64_t ino;
+    int rc = minivsfs_alloc(fs, blocks_needed, &ino, blocks);
+    if (rc != MINIVSFS_OK)
+        return rc;
+
+    // the inode and blocks are ours now; fill them without holding any lock
+    for (uint64_t i = 0; i < blocks_needed; i++)
+    {
+        uint8_t *block_ptr = fs->image + (uint64_t)blocks[i] * BS;
+        uint64_t bytes = (i == blocks_needed - 1) ? size - i * BS : BS;
+        memcpy(block_ptr, (const uint8_t *)data + i * BS, bytes);
+        STAT_ADD(data_bytes_copied, bytes);
+        if (bytes < BS)
+            memset(block_ptr + bytes, 0, BS - bytes);
+    }
+
+    inode_t *new_inode = inode_at(fs, ino);
+    clear_inode(new_inode);
+
+    time_t now = time(NULL);
+    new_inode->generation++;
+    new_inode->mode = MODE_FILE;
+    new_inode->links = 1;
+    new_inode->size_bytes = size;
+    new_inode->atime = now;
+    new_inode->mtime = now;
+    new_inode->ctime = now;
+    for (uint64_t i = 0; i < blocks_needed; i++)
+        new_inode->direct[i] = blocks[i];
+    inode_crc_finalize(new_inode);
+
+    rc = dir_insert(fs, name, ino, now);
+    if (rc != MINIVSFS_OK)
+    {
+        clear_inode(new_inode);
+        release_blocks(fs, blocks, blocks_needed);
+        release_inode(fs, ino);
+        return rc;
+    }
+
+    if (ino_out)
+        *ino_out = ino;
+    return MINIVSFS_OK;
+}
+
+int minivsfs_add(minivsfs_t *fs, const char *name, const void *data, uint64_t size, uint64_t *ino_out)
+{
+    uint64_t t0 = phase_begin();
+    int rc = add_file(fs, name, data, size, ino_out);
+    phase_end(PHASE_ADD, t0, name);
+    return rc;
+}
+
+int minivsfs_lookup(minivsfs_t *fs, const char *name, uint64_t *ino_out)
+{
+    int rc = -MINIVSFS_ENOENT;
+
+    pthread_mutex_lock(&fs->dir_lock);
+    const dirent64_t *entry = dir_find(fs, name);
+    if (entry)
+    {
+        *ino_out = entry->inode_no;
+        rc = MINIVSFS_OK;
+    }
+    pthread_mutex_unlock(&fs->dir_lock);
+    return rc;
+}
+
+static int remove_file(minivsfs_t *fs, const char *name)
+{
+    pthread_mutex_lock(&fs->dir_lock);
+    dirent64_t *entry = dir_find(fs, name);
+    if (!entry || entry->type != FILE_TYPE_FILE)
+    {
+        pthread_mutex_unlock(&fs->dir_lock);
+        return -MINIVSFS_ENOENT;
+    }
+
+    // a zeroed entry is a free slot to dir_insert and invisible to everyone else
+    uint64_t ino = entry->inode_no;
+    memset(entry, 0, sizeof(dirent64_t));
+
+    time_t now = time(NULL);
+    inode_t *root_inode = inode_at(fs, ROOT_INO);
+    root_inode->size_bytes -= sizeof(dirent64_t);
+    root_inode->links--;
+    root_inode->mtime = now;
+    root_inode->ctime = now;
+    inode_crc_finalize(root_inode);
+    pthread_mutex_unlock(&fs->dir_lock);
+
+    // unreachable now, so nobody else can be looking at the inode
+    inode_t *inode = inode_at(fs, ino);
+    uint32_t blocks[DIRECT_MAX];
+    uint64_t nblocks = (inode->size_bytes + BS - 1) / BS;
+    if (nblocks > DIRECT_MAX)
+        nblocks = DIRECT_MAX;
+    memcpy(blocks, inode->direct, sizeof(blocks));
+    clear_inode(inode);
+
+    discard_blocks(fs, blocks, nblocks);
+    release_inode(fs, ino);
+    return MINIVSFS_OK;
+}
+
+int minivsfs_remove(minivsfs_t *fs, const char *name)
+{
+    uint64_t t0 = phase_begin();
+    int rc = remove_file(fs, name);
+    phase_end(PHASE_REMOVE, t0, name);
+    return rc;
+}
+
+static int replace_file(minivsfs_t *fs, const char *name, const void *data, uint64_t size, uint64_t *ino_out)
+{
+    uint64_t blocks_needed = (size + BS - 1) / BS;
+    if (blocks_needed > DIRECT_MAX)
+        return -MINIVSFS_EFBIG;
+
+    // held throughout so two replaces of one name cannot interleave
+    pthread_mutex_lock(&fs->dir_lock);
+    const dirent64_t *entry = dir_find(fs, name);
+    if (!entry || entry->type != FILE_TYPE_FILE)
+    {
+        pthread_mutex_unlock(&fs->dir_lock);
+        return -MINIVSFS_ENOENT;
+    }
+
+    uint64_t ino = entry->inode_no;
+    inode_t *inode = inode_at(fs, ino);
+    uint64_t old_blocks = (inode->size_bytes + BS - 1) / BS;
+    if (old_blocks > DIRECT_MAX)
+        old_blocks = DIRECT_MAX;
+    uint32_t blocks[DIRECT_MAX];
+    memcpy(blocks, inode->direct, sizeof(blocks));
+
+    // keep the blocks already owned and only allocate the growth, next to the inode
+    if (blocks_needed > old_blocks)
+    {
+        uint32_t g = (ino - 1) / fs->sb->inodes_per_group;
+        if (alloc_data_blocks(fs, g, blocks_needed - old_blocks, blocks + old_blocks) < 0)
+        {
+            pthread_mutex_unlock(&fs->dir_lock);
+            return -MINIVSFS_ENOSPC;
+        }
+    }
+
+    for (uint64_t i = 0; i < blocks_needed; i++)
+    {
+        uint8_t *block_ptr = fs->image + (uint64_t)blocks[i] * BS;
+        uint64_t bytes = (i == blocks_needed - 1) ? size - i * BS : BS;
+        memcpy(block_ptr, (const uint8_t *)data + i * BS, bytes);
+        STAT_ADD(data_bytes_copied, bytes);
+        if (bytes < BS)
+            memset(block_ptr + bytes, 0, BS - bytes);
+    }
+    if (blocks_needed < old_blocks)
+        discard_blocks(fs, blocks + blocks_needed, old_blocks - blocks_needed);
+
+    time_t now = time(NULL);
+    inode->generation++;
+    inode->size_bytes = size;
+    inode->mtime = now;
+    inode->ctime = now;
+    for (uint64_t i = 0; i < DIRECT_MAX; i++)
+        inode->direct[i] = i < blocks_needed ? blocks[i] : 0;
+    inode_crc_finalize(inode);
+    pthread_mutex_unlock(&fs->dir_lock);
+
+    if (ino_out)
+        *ino_out = ino;
+    return MINIVSFS_OK;
+}
+
+int minivsfs_replace(minivsfs_t *fs, const char *name, const void *data, uint64_t size, uint64_t *ino_out)
+{
+    uint64_t t0 = phase_begin();
+    int rc = replace_file(fs, name, data, size, ino_out);
+    phase_end(PHASE_REPLACE, t0, name);
+    return rc;
+}
+
+int minivsfs_stat(minivsfs_t *fs, uint64_t ino, inode_t *out)
+{
+    const superblock_t *sb = fs->sb;
+    if (ino < 1 || ino > sb->inode_count)
+        return -MINIVSFS_ENOENT;
+
+    uint32_t g = (ino - 1) / sb->inodes_per_group;
+    if (!test_bit(fs->image + group_inode_bitmap_block(sb, g) * BS, (ino - 1) % sb->inodes_per_group))
+        return -MINIVSFS_ENOENT;
+
+    memcpy(out, inode_at(fs, ino), sizeof(inode_t));
+    return MINIVSFS_OK;
+}
+
+int64_t minivsfs_read(minivsfs_t *fs, uint64_t ino, void *buf, uint64_t size, uint64_t offset)
+{
+    inode_t inode;
+    int rc = minivsfs_stat(fs, ino, &inode);
+    if (rc != MINIVSFS_OK)
+        return rc;
+
+    if (inode.size_bytes > (uint64_t)DIRECT_MAX * BS) // past direct[]: a corrupt inode
+        return -MINIVSFS_EBADFS;
+    if (offset >= inode.size_bytes)
+        return 0;
+    if (size > inode.size_bytes - offset)
+        size = inode.size_bytes - offset;
+
+    uint64_t done = 0;
+    while (done < size)
+    {
+        uint64_t pos = offset + done;
+        uint64_t block = inode.direct[pos / BS];
+        uint64_t chunk = BS - pos % BS;
+        if (chunk > size - done)
+            chunk = size - done;
+        if (block < fs->sb->data_region_start || block >= fs->sb->total_blocks)
+            return -MINIVSFS_EBADFS;
+        memcpy((uint8_t *)buf + done, fs->image + block * BS + pos % BS, chunk);
+        STAT_ADD(data_bytes_copied, chunk);
+        done += chunk;
+    }
+    return (int64_t)done;
+}
+
+// inode CRCs, dirents, block ownership vs bitmaps, then the counters and summary
+int minivsfs_check(minivsfs_t *fs, int repair)
+{
+    const superblock_t *sb = fs->sb;
+    uint64_t t0 = phase_begin();
+    uint8_t *owned = calloc((sb->total_blocks + 7) / 8, 1);
+    if (!owned)
+        return -MINIVSFS_ENOMEM;
+
+    int problems = 0;
+    for (uint32_t g = 0; g < sb->group_count; g++)
+    {
+        const uint8_t *inode_bitmap = fs->image + group_inode_bitmap_block(sb, g) * BS;
+        for (uint64_t idx = 0; idx < sb->inodes_per_group; idx++)
+        {
+            if (!test_bit(inode_bitmap, idx))
+                continue;
+
+            inode_t tmp = *inode_at(fs, (uint64_t)g * sb->inodes_per_group + idx + 1);
+            uint64_t stored_crc = tmp.inode_crc;
+            inode_crc_finalize(&tmp);
+            problems += tmp.inode_crc != stored_crc;
+
+            uint64_t nblocks = (tmp.size_bytes + BS - 1) / BS;
+            if (tmp.mode == MODE_DIR)
+                nblocks = 1;
+            if (nblocks > DIRECT_MAX)
+            {
+                problems++;
+                nblocks = DIRECT_MAX;
+            }
+            for (uint64_t b = 0; b < nblocks; b++)
+            {
+                uint64_t block = tmp.direct[b];
+                uint32_t bg = block_group(sb, block);
+                if (block < group_data_start(sb, bg) || block - group_data_start(sb, bg) >= group_data_blocks(sb, bg))
+                {
+                    problems++;
+                    continue;
+                }
+                problems += !test_bit(data_bitmap(fs, bg), block - group_data_start(sb, bg));
+                problems += test_bit(owned, block); // shared with another inode
+                set_bit(owned, block);
+            }
+        }
+    }
+
+    // leaked blocks: allocated in a bitmap but owned by no inode
+    for (uint32_t g = 0; g < sb->group_count; g++)
+    {
+        uint64_t start = group_data_start(sb, g);
+        for (uint64_t i = 0; i < group_data_blocks(sb, g); i++)
+            problems += test_bit(data_bitmap(fs, g), i) && !test_bit(owned, start + i);
+    }
+    free(owned);
+
+    const inode_t *root_inode = inode_at(fs, ROOT_INO);
+    const dirent64_t *root_entries = (const dirent64_t *)(fs->image + (uint64_t)root_inode->direct[0] * BS);
+    uint64_t live_entries = 0;
+    for (uint32_t i = 0; i < BS / sizeof(dirent64_t); i++)
+    {
+        dirent64_t de = root_entries[i];
+        if (de.inode_no == 0)
+            continue;
+        live_entries++;
+
+        uint8_t stored = de.checksum;
+        dirent_checksum_finalize(&de);
+        problems += de.checksum != stored;
+
+        inode_t unused;
+        problems += minivsfs_stat(fs, de.inode_no, &unused) != MINIVSFS_OK;
+    }
+    problems += root_inode->size_bytes != live_entries * sizeof(dirent64_t);
+
+    // recount from the bitmaps and compare with the live counters
+    uint64_t free_blocks = fs->free_blocks, free_inodes = fs->free_inodes;
+    uint32_t group_free_blocks[GROUPS_MAX], group_free_inodes[GROUPS_MAX];
+    uint16_t free_run_max[FREE_RUN_SLICES_MAX];
+    memcpy(group_free_blocks, fs->group_free_blocks, sizeof(group_free_blocks));
+    memcpy(group_free_inodes, fs->group_free_inodes, sizeof(group_free_inodes));
+    memcpy(free_run_max, fs->free_run_max, sizeof(free_run_max));
+
+    rebuild_free_space_summary(fs);
+    problems += free_blocks != fs->free_blocks;
+    problems += free_inodes != fs->free_inodes;
+    for (uint32_t g = 0; g < sb->group_count; g++)
+    {
+        problems += group_free_blocks[g] != fs->group_free_blocks[g];
+        problems += group_free_inodes[g] != fs->group_free_inodes[g];
+    }
+    for (uint32_t s = 0; s < sb->free_run_slices; s++)
+        problems += free_run_max[s] != fs->free_run_max[s];
+
+    if (!repair)
+    {
+        fs->free_blocks = free_blocks;
+        fs->free_inodes = free_inodes;
+        memcpy(fs->group_free_blocks, group_free_blocks, sizeof(group_free_blocks));
+        memcpy(fs->group_free_inodes, group_free_inodes, sizeof(group_free_inodes));
+        memcpy(fs->free_run_max, free_run_max, sizeof(free_run_max));
+    }
+    phase_end(PHASE_CHECK, t0, NULL);
+    return problems;
+}
+
+// ---- compaction ----
+typedef struct
+{
+    uint64_t ino;
+    uint64_t first; // current first block; files keep their on-disk order
+} defrag_file_t;
+
+static int compare_first_block(const void *a, const void *b)
+{
+    uint64_t x = ((const defrag_file_t *)a)->first, y = ((const defrag_file_t *)b)->first;
+    return (x > y) - (x < y);
+}
+
+static uint64_t inode_blocks(const inode_t *inode)
+{
+    if (inode->mode == MODE_DIR)
+        return 1;
+    uint64_t n = (inode->size_bytes + BS - 1) / BS;
+    return n < DIRECT_MAX ? n : DIRECT_MAX;
+}
+
+// lays the files of each inode group end to end from that group's data start, in their
+// current order, so files already in place stay put. Fills dest[src] and the target map;
+// nothing in the image changes
+static int plan_compaction(minivsfs_t *fs, uint32_t *dest, uint8_t *target, defrag_file_t *files)
+{
+    const superblock_t *sb = fs->sb;
+    uint32_t cg = 0; // target group and position inside its data region
+    uint64_t pos = 0;
+
+    for (uint32_t g = 0; g < sb->group_count; g++)
+    {
+        const uint8_t *inode_bitmap = fs->image + group_inode_bitmap_block(sb, g) * BS;
+        uint64_t n = 0;
+        for (uint64_t idx = 0; idx < sb->inodes_per_group; idx++)
+        {
+            uint64_t ino = (uint64_t)g * sb->inodes_per_group + idx + 1;
+            if (test_bit(inode_bitmap, idx) && inode_blocks(inode_at(fs, ino)) > 0)
+                files[n++] = (defrag_file_t){ino, inode_at(fs, ino)->direct[0]};
+        }
+        qsort(files, n, sizeof(defrag_file_t), compare_first_block);
+
+        if (cg < g) // earlier groups may have spilled into this one
+        {
+            cg = g;
+            pos = 0;
+        }
+        for (uint64_t f = 0; f < n; f++)
+        {
+            const inode_t *inode = inode_at(fs, files[f].ino);
+            uint64_t nblocks = inode_blocks(inode);
+            while (cg < sb->group_count && pos + nblocks > group_data_blocks(sb, cg))
+            {
+                cg++;
+                pos = 0;
+            }
+            if (cg == sb->group_count)
+                return -MINIVSFS_ENOSPC;
+
+            for (uint64_t b = 0; b < nblocks; b++)
+            {
+                uint64_t block = inode->direct[b];
+                uint32_t bg = block_group(sb, block);
+                if (block < group_data_start(sb, bg) || block - group_data_start(sb, bg) >= group_data_blocks(sb, bg) ||
+                    dest[block]) // out of range or shared: let fsck deal with it first
+                    return -MINIVSFS_EBADFS;
+                dest[block] = group_data_start(sb, cg) + pos + b;
+                set_bit(target, dest[block]);
+            }
+            pos += nblocks;
+        }
+    }
+    return MINIVSFS_OK;
+}
+
+// carries out dest[] with one copy per block: a block is moved once its target has been
+// vacated, so each chain of moves runs back to front and a cycle goes through one bounce
+// buffer. Returns the number of blocks moved
+static uint64_t move_blocks(minivsfs_t *fs, const uint32_t *dest, uint8_t *pending, uint32_t *chain)
+{
+    const superblock_t *sb = fs->sb;
+    uint8_t bounce[BS];
+    uint64_t moved = 0;
+
+    for (uint64_t b = 0; b < sb->total_blocks; b++)
+    {
+        if (dest[b] && dest[b] != b)
+            set_bit(pending, b);
+    }
+
+    for (uint64_t b = 0; b < sb->total_blocks; b++)
+    {
+        if (!test_bit(pending, b))
+            continue;
+
+        // targets are unique, so following them from b either reaches a free block or b
+        uint64_t len = 0, cur = b;
+        do
+        {
+            chain[len++] = cur;
+            cur = dest[cur];
+        } while (cur != b && test_bit(pending, cur));
+
+        uint8_t *tail = (cur == b) ? bounce : fs->image + cur * BS;
+        memcpy(tail, fs->image + (uint64_t)chain[len - 1] * BS, BS);
+        for (uint64_t i = len - 1; i > 0; i--)
+            memcpy(fs->image + (uint64_t)chain[i] * BS, fs->image + (uint64_t)chain[i - 1] * BS, BS);
+        if (cur == b)
+            memcpy(fs->image + b * BS, bounce, BS);
+
+        for (uint64_t i = 0; i < len; i++)
+            clear_bit(pending, chain[i]);
+        moved += len;
+        STAT_ADD(data_bytes_copied, len * BS);
+    }
+    return moved;
+}
+
+// drops the free tail of the last group, keeping at least one data block in it
+static void truncate_free_tail(minivsfs_t *fs)
+{
+    superblock_t *sb = fs->sb;
+    uint32_t last = sb->group_count - 1;
+    const uint8_t *bitmap = data_bitmap(fs, last);
+
+    uint64_t keep = group_data_blocks(sb, last);
+    while (keep > 1 && !test_bit(bitmap, keep - 1))
+        keep--;
+
+    uint64_t cut = group_data_blocks(sb, last) - keep;
+    sb->total_blocks -= cut;
+    sb->data_region_blocks -= cut;
+    fs->image_size = sb->total_blocks * BS;
+}
+
+int minivsfs_defrag(minivsfs_t *fs, int truncate, uint64_t *moved_out)
+{
+    superblock_t *sb = fs->sb;
+    uint64_t t0 = phase_begin();
+    uint64_t bitmap_bytes = (sb->total_blocks + 7) / 8;
+    uint32_t *dest = calloc(sb->total_blocks, sizeof(uint32_t));
+    uint32_t *chain = malloc(sb->total_blocks * sizeof(uint32_t));
+    uint8_t *target = calloc(bitmap_bytes, 1);
+    uint8_t *pending = calloc(bitmap_bytes, 1);
+    defrag_file_t *files = malloc(sb->inodes_per_group * sizeof(defrag_file_t));
+
+    int rc = -MINIVSFS_ENOMEM;
+    if (!dest || !chain || !target || !pending || !files)
+        goto out;
+    if ((rc = plan_compaction(fs, dest, target, files)) != MINIVSFS_OK)
+        goto out;
+
+    uint64_t moved = move_blocks(fs, dest, pending, chain);
+
+    for (uint32_t g = 0; g < sb->group_count; g++)
+    {
+        const uint8_t *inode_bitmap = fs->image + group_inode_bitmap_block(sb, g) * BS;
+        for (uint64_t idx = 0; idx < sb->inodes_per_group; idx++)
+        {
+            inode_t *inode = inode_at(fs, (uint64_t)g * sb->inodes_per_group + idx + 1);
+            uint64_t nblocks = test_bit(inode_bitmap, idx) ? inode_blocks(inode) : 0;
+            int changed = 0;
+            for (uint64_t b = 0; b < nblocks; b++)
+            {
+                changed |= dest[inode->direct[b]] != inode->direct[b];
+                inode->direct[b] = dest[inode->direct[b]];
+            }
+            if (changed)
+                inode_crc_finalize(inode);
+        }
+
+        // the bitmap becomes the target map; blocks left behind are zeroed like removed ones
+        uint8_t *bitmap = data_bitmap(fs, g);
+        uint64_t start = group_data_start(sb, g);
+        for (uint64_t i = 0; i < group_data_blocks(sb, g); i++)
+        {
+            if (test_bit(target, start + i))
+                set_bit(bitmap, i);
+            else if (test_bit(bitmap, i))
+            {
+                clear_bit(bitmap, i);
+                memset(fs->image + (start + i) * BS, 0, BS);
+            }
+        }
+    }
+
+    if (truncate)
+        truncate_free_tail(fs);
+    rebuild_free_space_summary(fs);
+    if (moved_out)
+        *moved_out = moved;
+    phase_end(PHASE_DEFRAG, t0, NULL);
+
+out:
+    free(dest);
+    free(chain);
+    free(target);
+    free(pending);
+    free(files);
+    return rc;
+}
+
+// ---- resize ----
+// inode_count is a minimum: spread over groups, never below the current per-group count
+// (tables only grow), in whole inode table blocks when grouped; 0 keeps the per-group count
+static uint64_t resize_inodes_per_group(const superblock_t *sb, uint64_t groups, uint64_t inode_count)
+{
+    uint64_t inodes_per_group = (inode_count + groups - 1) / groups;
+    if (inodes_per_group < sb->inodes_per_group)
+        inodes_per_group = sb->inodes_per_group;
+    if (groups > 1)
+        inodes_per_group = (inodes_per_group + BS / INODE_SIZE - 1) / (BS / INODE_SIZE) * (BS / INODE_SIZE);
+    return inodes_per_group;
+}
+
+// the layout after a resize, by init_superblock's rules: a flat image stays one group,
+// a grouped one keeps its group stride. At the same size the group count stays, even
+// if the last group is short; a new size gains or loses whole groups, and the leftover
+// becomes a short last group, as defrag --truncate leaves, unless it cannot hold that
+// group's metadata and a data block, in which case the group before it absorbs it.
+// Inode tables only grow
+static int resize_geometry(const superblock_t *sb, uint64_t total_blocks, uint64_t inode_count, superblock_t *geo)
+{
+    memcpy(geo, sb, sizeof(superblock_t));
+    if (total_blocks < 2)
+        return -MINIVSFS_EINVAL;
+
+    uint64_t groups = 1, blocks_per_group = total_blocks - 1;
+    if (sb->group_count > 1)
+    {
+        blocks_per_group = sb->blocks_per_group;
+        groups = sb->group_count;
+        if (total_blocks != sb->total_blocks)
+            groups = (total_blocks - 1 + blocks_per_group - 1) / blocks_per_group;
+    }
+    uint64_t inodes_per_group = resize_inodes_per_group(sb, groups, inode_count);
+    uint64_t tail = total_blocks - 1 - (groups - 1) * blocks_per_group;
+    if (groups > 1 && total_blocks != sb->total_blocks && tail < 3 + (inodes_per_group * INODE_SIZE + BS - 1) / BS)
+    {
+        groups--;
+        inodes_per_group = resize_inodes_per_group(sb, groups, inode_count);
+    }
+    if (groups < 1 || groups > GROUPS_MAX || inodes_per_group > BS * 8)
+        return -MINIVSFS_EINVAL;
+
+    geo->total_blocks = total_blocks;
+    geo->group_count = groups;
+    geo->blocks_per_group = blocks_per_group;
+    geo->inodes_per_group = inodes_per_group;
+    geo->inode_count = inodes_per_group * groups;
+    geo->inode_table_blocks = (inodes_per_group * INODE_SIZE + BS - 1) / BS;
+    geo->data_region_start = geo->inode_table_start + geo->inode_table_blocks;
+    int rc = check_geometry(geo);
+    if (rc != MINIVSFS_OK)
+        return rc;
+
+    geo->data_region_blocks = 0;
+    for (uint32_t g = 0; g < groups; g++)
+        geo->data_region_blocks += group_data_blocks(geo, g);
+    return MINIVSFS_OK;
+}
+
+static int is_data_block(const superblock_t *sb, uint64_t block)
+{
+    if (block >= sb->total_blocks || block < sb->data_region_start)
+        return 0;
+    uint32_t g = block_group(sb, block);
+    return block >= group_data_start(sb, g);
+}
+
+// first block that is data under geo and still unclaimed, in group g or after it
+static uint64_t resize_target(const superblock_t *geo, const uint8_t *used, uint64_t *cursor, uint32_t g)
+{
+    for (uint32_t i = 0; i < geo->group_count; i++)
+    {
+        uint32_t cg = (g + i) % geo->group_count;
+        uint64_t end = group_data_start(geo, cg) + group_data_blocks(geo, cg);
+        while (cursor[cg] < end && test_bit(used, cursor[cg]))
+            cursor[cg]++;
+        if (cursor[cg] < end)
+            return cursor[cg];
+    }
+    return 0;
+}
+
+int minivsfs_resize(minivsfs_t *fs, uint64_t size_kib, uint64_t inode_count, uint64_t *moved_out)
+{
+    superblock_t *sb = fs->sb;
+    superblock_t geo;
+    int rc = resize_geometry(sb, size_kib ? size_kib * 1024 / BS : sb->total_blocks, inode_count, &geo);
+    if (rc != MINIVSFS_OK)
+        return rc;
+
+    uint64_t t0 = phase_begin();
+    uint64_t old_total = sb->total_blocks;
+    uint64_t max_total = old_total > geo.total_blocks ? old_total : geo.total_blocks;
+    uint64_t *owner = calloc(old_total, sizeof(uint64_t)); // ino * DIRECT_MAX + index + 1
+    uint8_t *used = calloc((max_total + 7) / 8, 1);
+    uint64_t *moves = malloc(old_total * 2 * sizeof(uint64_t)); // source, target pairs
+    uint64_t cursor[GROUPS_MAX];
+    uint64_t nmoves = 0;
+
+    rc = -MINIVSFS_ENOMEM;
+    if (!owner || !used || !moves)
+        goto out;
+
+    // who owns what; inodes in groups that disappear cannot be renumbered away
+    rc = -MINIVSFS_EBADFS;
+    for (uint32_t g = 0; g < sb->group_count; g++)
+    {
+        const uint8_t *inode_bitmap = fs->image + group_inode_bitmap_block(sb, g) * BS;
+        for (uint64_t idx = 0; idx < sb->inodes_per_group; idx++)
+        {
+            if (!test_bit(inode_bitmap, idx))
+                continue;
+            if (g >= geo.group_count)
+            {
+                rc = -MINIVSFS_ENOSPC;
+                goto out;
+            }
+            uint64_t ino = (uint64_t)g * sb->inodes_per_group + idx + 1;
+            const inode_t *inode = inode_at(fs, ino);
+            for (uint64_t b = 0; b < inode_blocks(inode); b++)
+            {
+                uint64_t block = inode->direct[b];
+                if (!is_data_block(sb, block) || owner[block])
+                    goto out;
+                owner[block] = ino * DIRECT_MAX + b + 1;
+            }
+        }
+    }
+
+    // blocks that are still data under the new layout stay where they are; the rest,
+    // the ones now covered by inode tables or past the new end, move to unclaimed data
+    // blocks near their inode. Nothing is copied until every target is known
+    for (uint64_t b = 0; b < old_total; b++)
+    {
+        if (owner[b] && is_data_block(&geo, b))
+            set_bit(used, b);
+    }
+    for (uint32_t g = 0; g < geo.group_count; g++)
+        cursor[g] = group_data_start(&geo, g);
+    rc = -MINIVSFS_ENOSPC;
+    for (uint64_t b = 0; b < old_total; b++)
+    {
+        if (!owner[b] || is_data_block(&geo, b))
+            continue;
+        uint64_t ino = (owner[b] - 1) / DIRECT_MAX;
+        uint64_t target = resize_target(&geo, used, cursor, (ino - 1) / sb->inodes_per_group);
+        if (!target)
+            goto out;
+        set_bit(used, target);
+        moves[2 * nmoves] = b;
+        moves[2 * nmoves + 1] = target;
+        nmoves++;
+    }
+
+    if (max_total > old_total)
+    {
+        uint8_t *image = realloc(fs->image, max_total * BS);
+        rc = -MINIVSFS_ENOMEM;
+        if (!image)
+            goto out;
+        fs->image = image;
+        fs->sb = sb = (superblock_t *)fs->image;
+        memset(fs->image + old_total * BS, 0, (max_total - old_total) * BS);
+    }
+
+    // targets were all unowned, so the copies cannot clobber each other
+    for (uint64_t m = 0; m < nmoves; m++)
+    {
+        uint64_t source = moves[2 * m], target = moves[2 * m + 1];
+        memcpy(fs->image + target * BS, fs->image + source * BS, BS);
+        STAT_ADD(data_bytes_copied, BS);
+
+        inode_t *inode = inode_at(fs, (owner[source] - 1) / DIRECT_MAX);
+        inode->direct[(owner[source] - 1) % DIRECT_MAX] = target;
+        inode_crc_finalize(inode);
+    }
+
+    // a table slot keeps its group and index, so only inode numbers past group 0 change
+    if (geo.inodes_per_group != sb->inodes_per_group)
+    {
+        inode_t *root_inode = inode_at(fs, ROOT_INO);
+        dirent64_t *root_entries = (dirent64_t *)(fs->image + (uint64_t)root_inode->direct[0] * BS);
+        for (uint32_t i = 0; i < BS / sizeof(dirent64_t); i++)
+        {
+            uint64_t ino = root_entries[i].inode_no;
+            if (ino == 0)
+                continue;
+            uint64_t g = (ino - 1) / sb->inodes_per_group;
+            root_entries[i].inode_no = g * geo.inodes_per_group + (ino - 1) % sb->inodes_per_group + 1;
+            dirent_checksum_finalize(&root_entries[i]);
+        }
+    }
+
+    // fresh metadata: whole new groups, and the inode table growth of the old ones
+    for (uint32_t g = 0; g < geo.group_count; g++)
+    {
+        uint64_t first = g < sb->group_count ? group_data_start(sb, g) : group_inode_bitmap_block(&geo, g);
+        if (first < group_data_start(&geo, g))
+            memset(fs->image + first * BS, 0, (group_data_start(&geo, g) - first) * BS);
+    }
+
+    // data bitmaps from the blocks that stayed or arrived. Free blocks that were not
+    // data before (metadata of a dropped group) are cleared; commit leaves every free
+    // data block as a hole, so new space costs no disk
+    for (uint32_t g = 0; g < geo.group_count; g++)
+    {
+        uint8_t *bitmap = fs->image + group_data_bitmap_block(&geo, g) * BS;
+        uint64_t start = group_data_start(&geo, g);
+        memset(bitmap, 0, BS);
+        for (uint64_t i = 0; i < group_data_blocks(&geo, g); i++)
+        {
+            if (test_bit(used, start + i))
+                set_bit(bitmap, i);
+            else if (!is_data_block(sb, start + i))
+                memset(fs->image + (start + i) * BS, 0, BS);
+        }
+    }
+
+    memcpy(sb, &geo, offsetof(superblock_t, free_blocks_count));
+    fs->image_size = geo.total_blocks * BS;
+    rebuild_free_space_summary(fs);
+    if (moved_out)
+        *moved_out = nmoves;
+    phase_end(PHASE_RESIZE, t0, NULL);
+    rc = MINIVSFS_OK;
+
+out:
+    free(owner);
+    free(used);
+    free(moves);
+    return rc;
+}
+
+const superblock_t *minivsfs_superblock(minivsfs_t *fs)
+{
+    store_free_space_summary(fs);
+    return fs->sb;
+}
+
+static int is_free_data_block(minivsfs_t *fs, uint64_t block)
+{
+    const superblock_t *sb = fs->sb;
+    if (!is_data_block(sb, block))
+        return 0;
+    uint32_t g = block_group(sb, block);
+    return !test_bit(data_bitmap(fs, g), block - group_data_start(sb, g));
+}
+
+// the file is cut to nothing and sized up front, then only metadata and allocated data
+// are written: every free data block stays a hole, however the image got there
+static int write_image(minivsfs_t *fs, const char *path)
+{
+    store_free_space_summary(fs);
+    fs->sb->mtime_epoch = time(NULL);
+    superblock_crc_finalize(fs->sb);
+
+    int fd = io_open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0)
+        return -MINIVSFS_EIO;
+
+    uint64_t blocks = fs->image_size / BS;
+    int rc = io_truncate(fd, fs->image_size) == 0 ? MINIVSFS_OK : -MINIVSFS_EIO;
+    for (uint64_t b = 0; b < blocks && rc == MINIVSFS_OK;)
+    {
+        if (is_free_data_block(fs, b))
+        {
+            b++;
+            continue;
+        }
+        uint64_t start = b;
+        while (b < blocks && !is_free_data_block(fs, b))
+            b++;
+        if (io_write(fd, fs->image + start * BS, (b - start) * BS, start * BS) != 0)
+            rc = -MINIVSFS_EIO;
+    }
+    if (rc == MINIVSFS_OK && fs->image_size % BS &&
+        io_write(fd, fs->image + blocks * BS, fs->image_size % BS, blocks * BS) != 0)
+        rc = -MINIVSFS_EIO;
+    if (io_close(fd) != 0)
+        rc = -MINIVSFS_EIO;
+    return rc;
+}
+
+int minivsfs_commit(minivsfs_t *fs, const char *path)
+{
+    if (!path && !fs->path)
+        return -MINIVSFS_EINVAL;
+
+    uint64_t t0 = phase_begin();
+    int rc = write_image(fs, path ? path : fs->path);
+    phase_end(PHASE_COMMIT, t0, path ? path : fs->path);
+    return rc;
+}
+
+void minivsfs_close(minivsfs_t *fs)
+{
+    if (!fs)
+        return;
+    free(fs->image);
+    free(fs->path);
+    free(fs);
+}
+
+// ---- block-level deltas ----
+enum
+{
+    BLOCK_SAME,
+    BLOCK_DATA, // send the target's contents
+    BLOCK_ZERO, // target is all zeros: punch instead of sending
+};
+
+#define DIFF_CHUNK 256u // blocks claimed by a worker at a time
+
+typedef struct
+{
+    const minivsfs_t *base;
+    const minivsfs_t *target;
+    uint8_t *state; // one BLOCK_* per target block
+    uint64_t next;  // claimed atomically by the workers
+} diff_job_t;
+
+static int is_zero_block(const uint8_t *block)
+{
+    static const uint8_t zero[BS];
+    return memcmp(block, zero, BS) == 0;
+}
+
+// checksums the whole delta, header included, with the checksum field zeroed
+static uint32_t delta_crc_finalize(uint8_t *delta, uint64_t size)
+{
+    delta_header_t *header = (delta_header_t *)delta;
+    STAT_ADD(crc_bytes, size);
+    header->checksum = 0;
+    header->checksum = minivsfs_crc32(delta, size);
+    return header->checksum;
+}
+
+static void *diff_worker(void *arg)
+{
+    diff_job_t *job = arg;
+    uint64_t base_blocks = job->base->image_size / BS;
+    uint64_t target_blocks = job->target->image_size / BS;
+
+    for (;;)
+    {
+        uint64_t start = __atomic_fetch_add(&job->next, DIFF_CHUNK, __ATOMIC_RELAXED);
+        if (start >= target_blocks)
+            break;
+        uint64_t end = start + DIFF_CHUNK < target_blocks ? start + DIFF_CHUNK : target_blocks;
+        for (uint64_t b = start; b < end; b++)
+        {
+            const uint8_t *block = job->target->image + b * BS;
+            if (b < base_blocks && memcmp(job->base->image + b * BS, block, BS) == 0)
+                continue;
+            if (!is_zero_block(block))
+                job->state[b] = BLOCK_DATA;
+            else if (b < base_blocks) // growing the file supplies zeros already
+                job->state[b] = BLOCK_ZERO;
+        }
+    }
+    return NULL;
+}
+
+int minivsfs_diff(minivsfs_t *base, minivsfs_t *target, int jobs, const char *delta_path, minivsfs_delta_info_t *info)
+{
+    if (jobs < 1 || jobs > 64 || base->image_size % BS || target->image_size % BS)
+        return -MINIVSFS_EINVAL;
+
+    uint64_t t0 = phase_begin();
+    uint64_t target_blocks = target->image_size / BS;
+    memset(info, 0, sizeof(*info));
+
+    uint8_t *state = calloc(target_blocks, 1);
+    if (!state)
+        return -MINIVSFS_ENOMEM;
+
+    diff_job_t job = {base, target, state, 0};
+    pthread_t threads[64];
+    for (int t = 1; t < jobs; t++)
+        pthread_create(&threads[t], NULL, diff_worker, &job);
+    diff_worker(&job);
+    for (int t = 1; t < jobs; t++)
+        pthread_join(threads[t], NULL);
+
+    // coalesce into runs of one kind, then lay the delta out in one buffer
+    for (uint64_t b = 0; b < target_blocks; b++)
+    {
+        if (state[b] != BLOCK_DATA && state[b] != BLOCK_ZERO)
+            continue;
+        info->extents += b == 0 || state[b - 1] != state[b];
+        info->data_blocks += state[b] == BLOCK_DATA;
+        info->zero_blocks += state[b] == BLOCK_ZERO;
+    }
+    info->delta_bytes = sizeof(delta_header_t) + info->extents * sizeof(delta_extent_t) + info->data_blocks * BS;
+
+    uint8_t *delta = malloc(info->delta_bytes);
+    if (!delta)
+    {
+        free(state);
+        return -MINIVSFS_ENOMEM;
+    }
+    delta_header_t *header = (delta_header_t *)delta;
+    memset(header, 0, sizeof(*header));
+    header->magic = DELTA_MAGIC;
+    header->version = DELTA_VERSION;
+    header->base_blocks = base->image_size / BS;
+    header->base_mtime = base->sb->mtime_epoch;
+    header->base_checksum = base->sb->checksum;
+    header->target_checksum = target->sb->checksum;
+    header->target_blocks = target_blocks;
+    header->extent_count = info->extents;
+
+    uint8_t *p = delta + sizeof(delta_header_t);
+    for (uint64_t b = 0; b < target_blocks;)
+    {
+        uint8_t kind = state[b];
+        if (kind != BLOCK_DATA && kind != BLOCK_ZERO)
+        {
+            b++;
+            continue;
+        }
+        uint64_t start = b;
+        while (b < target_blocks && state[b] == kind)
+            b++;
+
+        delta_extent_t extent = {start, (uint32_t)(b - start), kind == BLOCK_ZERO};
+        memcpy(p, &extent, sizeof(extent));
+        p += sizeof(extent);
+        if (kind == BLOCK_DATA)
+        {
+            memcpy(p, target->image + start * BS, (b - start) * BS);
+            p += (b - start) * BS;
+        }
+    }
+    delta_crc_finalize(delta, info->delta_bytes);
+    free(state);
+
+    int rc = -MINIVSFS_EIO;
+    int fd = io_open(delta_path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd >= 0)
+    {
+        if (io_write(fd, delta, info->delta_bytes, 0) == 0)
+            rc = MINIVSFS_OK;
+        if (io_close(fd) != 0)
+            rc = -MINIVSFS_EIO;
+    }
+    free(delta);
+    phase_end(PHASE_DIFF, t0, delta_path);
+    return rc;
+}
+
+// reads and verifies a whole delta; nothing is applied from a damaged one
+static int load_delta(const char *delta_path, uint8_t **out, uint64_t *size_out)
+{
+    int fd = io_open(delta_path, O_RDONLY);
+    if (fd < 0)
+        return -MINIVSFS_EIO;
+
+    uint64_t size = 0;
+    int rc = io_size(fd, &size) == 0 ? MINIVSFS_OK : -MINIVSFS_EIO;
+    if (rc == MINIVSFS_OK && size < sizeof(delta_header_t))
+        rc = -MINIVSFS_EBADFS;
+    uint8_t *delta = rc == MINIVSFS_OK ? malloc(size) : NULL;
+    if (rc == MINIVSFS_OK && !delta)
+        rc = -MINIVSFS_ENOMEM;
+    if (rc == MINIVSFS_OK && io_read(fd, delta, size, 0) != 0)
+        rc = -MINIVSFS_EIO;
+    io_close(fd);
+    if (rc != MINIVSFS_OK)
+    {
+        free(delta);
+        return rc;
+    }
+
+    const delta_header_t *header = (const delta_header_t *)delta;
+    uint32_t stored = header->checksum;
+    if (header->magic != DELTA_MAGIC || header->version != DELTA_VERSION || delta_crc_finalize(delta, size) != stored)
+    {
+        free(delta);
+        return -MINIVSFS_EBADFS;
+    }
+
+    // no image is larger than the summary can describe; every extent must lie inside
+    // the target and be backed by the file, and exactly extent_count of them fill it
+    const uint64_t blocks_max = (uint64_t)FREE_RUN_SLICES_MAX * FREE_RUN_SLICE;
+    const uint8_t *p = delta + sizeof(delta_header_t), *end = delta + size;
+    rc = -MINIVSFS_EBADFS;
+    if (header->target_blocks < 1 || header->target_blocks > blocks_max || header->base_blocks > blocks_max)
+        goto bad;
+    for (uint64_t e = 0; e < header->extent_count; e++)
+    {
+        delta_extent_t extent;
+        if ((uint64_t)(end - p) < sizeof(extent))
+            goto bad;
+        memcpy(&extent, p, sizeof(extent));
+        p += sizeof(extent);
+        if (extent.count > header->target_blocks || extent.start > header->target_blocks - extent.count)
+            goto bad;
+        if (!extent.zero)
+        {
+            if ((uint64_t)(end - p) < (uint64_t)extent.count * BS)
+                goto bad;
+            p += (uint64_t)extent.count * BS;
+        }
+    }
+    if (p != end)
+        goto bad;
+    *out = delta;
+    *size_out = size;
+    return MINIVSFS_OK;
+
+bad:
+    free(delta);
+    return rc;
+}
+
+int minivsfs_apply(const char *image_path, const char *delta_path, minivsfs_delta_info_t *info)
+{
+    uint64_t t0 = phase_begin();
+    memset(info, 0, sizeof(*info));
+
+    uint8_t *delta;
+    uint64_t delta_size;
+    int rc = load_delta(delta_path, &delta, &delta_size);
+    if (rc != MINIVSFS_OK)
+        return rc;
+    const delta_header_t *header = (const delta_header_t *)delta;
+    info->delta_bytes = delta_size;
+
+    int fd = io_open(image_path, O_RDWR);
+    if (fd < 0)
+    {
+        free(delta);
+        return -MINIVSFS_EIO;
+    }
+
+    // the superblock identifies the base: its checksum changes with every commit
+    uint8_t block[BS];
+    const superblock_t *sb = (const superblock_t *)block;
+    uint64_t image_size;
+    rc = -MINIVSFS_EIO;
+    if (io_read(fd, block, BS, 0) != 0 || io_size(fd, &image_size) != 0)
+        goto out;
+    rc = -MINIVSFS_ESTALE;
+    if (sb->magic != FS_MAGIC || sb->checksum != header->base_checksum || sb->mtime_epoch != header->base_mtime ||
+        image_size != header->base_blocks * BS)
+        goto out;
+
+    rc = -MINIVSFS_EIO;
+    if (header->target_blocks > header->base_blocks && io_truncate(fd, header->target_blocks * BS) != 0)
+        goto out;
+
+    const uint8_t *p = delta + sizeof(delta_header_t);
+    for (uint64_t e = 0; e < header->extent_count; e++)
+    {
+        delta_extent_t extent;
+        memcpy(&extent, p, sizeof(extent));
+        p += sizeof(extent);
+
+        uint64_t bytes = (uint64_t)extent.count * BS;
+        if (extent.zero)
+        {
+            // filesystems without hole punching get the zeros written instead
+            static const uint8_t zero[BS];
+            if (io_punch(fd, extent.start * BS, bytes) != 0)
+            {
+                for (uint64_t i = 0; i < extent.count; i++)
+                {
+                    if (io_write(fd, zero, BS, (extent.start + i) * BS) != 0)
+                        goto out;
+                }
+            }
+            info->zero_blocks += extent.count;
+        }
+        else
+        {
+            if (io_write(fd, p, bytes, extent.start * BS) != 0)
+                goto out;
+            p += bytes;
+            info->data_blocks += extent.count;
+        }
+        info->extents++;
+    }
+
+    if (header->target_blocks < header->base_blocks && io_truncate(fd, header->target_blocks * BS) != 0)
+        goto out;
+
+    // the patched superblock must be the target's, CRC and all
+    if (io_read(fd, block, BS, 0) != 0)
+        goto out;
+    rc = -MINIVSFS_EBADFS;
+    superblock_t check;
+    memcpy(&check, block, sizeof(check));
+    if (check.checksum != header->target_checksum || superblock_crc_finalize((superblock_t *)block) != check.checksum)
+        goto out;
+    rc = MINIVSFS_OK;
+
+out:
+    if (io_close(fd) != 0 && rc == MINIVSFS_OK)
+        rc = -MINIVSFS_EIO;
+    free(delta);
+    phase_end(PHASE_APPLY, t0, image_path);
+    return rc;
+}
+
+// ---- command-line helpers shared by the mkfs_* tools ----
+static const minivsfs_opt_t STATS_OPTS[] = {
+    {"--stats", MINIVSFS_OPT_STR, &g_stats_format, NULL},
+    {"--trace", MINIVSFS_OPT_FLAG, &g_trace_opt, NULL},
+    {NULL, 0, NULL, NULL},
+};
+
+// the entry for name, or the terminating one
+static const minivsfs_opt_t *find_opt(const minivsfs_opt_t *opts, const char *name)
+{
+    while (opts->name && strcmp(name, opts->name) != 0)
+        opts++;
+    return opts;
+}
+
+int minivsfs_parse_opts(int argc, char *argv[], const minivsfs_opt_t *opts)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const minivsfs_opt_t *opt = find_opt(opts, argv[i]);
+        if (!opt->name)
+            opt = find_opt(STATS_OPTS, argv[i]);
+
+        if (opt->name && opt->kind == MINIVSFS_OPT_FLAG)
+        {
+            *(int *)opt->dest = 1;
+            continue;
+        }
+        if (!opt->name || i + 1 >= argc)
+        {
+            fprintf(stderr, "Unknown argument: %s\n", argv[i]);
+            return -1;
+        }
+
+        char *value = argv[++i];
+        switch (opt->kind)
+        {
+        case MINIVSFS_OPT_STR:
+            *(char **)opt->dest = value;
+            break;
+        case MINIVSFS_OPT_STR_LIST:
+            ((char **)opt->dest)[(*opt->count)++] = value;
+            break;
+        case MINIVSFS_OPT_U64:
+        {
+            char *end;
+            *(uint64_t *)opt->dest = strtoull(value, &end, 10);
+            if (*value == '\0' || *end != '\0')
+            {
+                fprintf(stderr, "Error: %s expects a number, got '%s'\n", opt->name, value);
+                return -1;
+            }
+            break;
+        }
+        case MINIVSFS_OPT_FLAG:
+            break;
+        }
+    }
+
+    if (g_stats_format && strcmp(g_stats_format, "human") != 0 && strcmp(g_stats_format, "json") != 0)
+    {
+        fprintf(stderr, "Error: --stats must be human or json\n");
+        return -1;
+    }
+    if (g_stats_format || g_trace_opt)
+        minivsfs_stats_enable(g_trace_opt);
+    if (g_stats_format)
+        atexit(print_requested_stats);
+    return 0;
+}
@@ -0,0 +1,273 @@
+// MiniVSFS image library: on-disk format plus open/format, alloc, add, remove, replace,
+// lookup, read and commit on an in-memory image. Everything from minivsfs_alloc through
+// minivsfs_read may be called from several threads on the same handle; allocation is
+// sharded by data bitmap slice and root directory updates are serialized.
+#ifndef MINIVSFS_H
+#define MINIVSFS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define BS 4096u
+#define INODE_SIZE 128u
+#define ROOT_INO 1u
+#define DIRECT_MAX 12
+#define FS_MAGIC 0x4D565346u
+#define FS_VERSION 3u
+
+// free-space summary: largest free run per FREE_RUN_SLICE data blocks of a group
+#define FREE_RUN_SLICE 256u
+#define FREE_RUN_SLICES_MAX 1024u // largest image / BS / FREE_RUN_SLICE
+#define GROUPS_MAX 64u
+
+// File type
+#define FILE_TYPE_FILE 1
+#define FILE_TYPE_DIR 2
+
+// Mode
+#define MODE_FILE 0100000
+#define MODE_DIR 0040000
+
+#pragma pack(push, 1)
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t total_blocks;
+    uint64_t inode_count;
+    uint64_t inode_bitmap_start;
+    uint64_t inode_bitmap_blocks;
+    uint64_t data_bitmap_start;
+    uint64_t data_bitmap_blocks;
+    uint64_t inode_table_start;
+    uint64_t inode_table_blocks;
+    uint64_t data_region_start;
+    uint64_t data_region_blocks;
+    uint64_t root_inode;
+    uint64_t mtime_epoch;
+    uint32_t flags;
+    uint32_t group_count;       // 1 = flat layout; *_start fields describe group 0
+    uint64_t blocks_per_group;  // stride between groups; the last one also takes the remainder
+    uint64_t inodes_per_group;
+    uint64_t free_blocks_count; // unallocated data blocks
+    uint64_t free_inodes_count; // unallocated inodes
+    uint32_t slices_per_group;
+    uint32_t free_run_slices;   // number of valid free_run_max entries
+    uint16_t free_run_max[FREE_RUN_SLICES_MAX];
+    uint32_t group_free_blocks[GROUPS_MAX];
+    uint32_t group_free_inodes[GROUPS_MAX];
+
+    // THIS FIELD SHOULD STAY AT THE END
+    // ALL OTHER FIELDS SHOULD BE ABOVE THIS
+    uint32_t checksum; // crc32(superblock[0..4091])
+} superblock_t;
+#pragma pack(pop)
+_Static_assert(sizeof(superblock_t) == 2720, "superblock must fit in one block");
+
+#pragma pack(push, 1)
+typedef struct
+{
+    uint16_t mode;
+    uint16_t links;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t size_bytes;
+    uint64_t atime;
+    uint64_t mtime;
+    uint64_t ctime;
+    uint32_t direct[12];
+    uint32_t generation; // bumped each time the slot gets new contents; survives remove
+    uint32_t reserved_1;
+    uint32_t reserved_2;
+    uint32_t proj_id;
+    uint32_t uid16_gid16;
+    uint64_t xattr_ptr;
+
+    // THIS FIELD SHOULD STAY AT THE END
+    // ALL OTHER FIELDS SHOULD BE ABOVE THIS
+    uint64_t inode_crc; // low 4 bytes store crc32 of bytes [0..119]; high 4 bytes 0
+
+} inode_t;
+#pragma pack(pop)
+_Static_assert(sizeof(inode_t) == INODE_SIZE, "inode size mismatch");
+
+#pragma pack(push, 1)
+typedef struct
+{
+    uint32_t inode_no;
+    uint8_t type;
+    char name[58];
+    uint8_t checksum; // XOR of bytes 0..62
+} dirent64_t;
+#pragma pack(pop)
+_Static_assert(sizeof(dirent64_t) == 64, "dirent size mismatch");
+
+// block-level delta between two images: a header, then extent_count extents, each
+// followed by count blocks of data unless it is a run of zeros
+#define DELTA_MAGIC 0x4D565344u
+#define DELTA_VERSION 2u
+
+#pragma pack(push, 1)
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t base_blocks; // the base image: file size in blocks, mtime_epoch and
+    uint64_t base_mtime;  // superblock checksum
+    uint32_t base_checksum;
+    uint32_t target_checksum;
+    uint64_t target_blocks;
+    uint64_t extent_count;
+    uint32_t checksum; // crc32 of the whole delta, this field zeroed
+} delta_header_t;
+
+typedef struct
+{
+    uint64_t start;
+    uint32_t count;
+    uint32_t zero; // 1 = the blocks became zeros; punched, no payload
+} delta_extent_t;
+#pragma pack(pop)
+_Static_assert(sizeof(delta_extent_t) == 16, "delta extent size mismatch");
+
+// error codes returned (negated) by the minivsfs_* calls
+#define MINIVSFS_OK 0
+#define MINIVSFS_EIO 1
+#define MINIVSFS_ENOMEM 2
+#define MINIVSFS_EBADFS 3
+#define MINIVSFS_ENOINODE 4
+#define MINIVSFS_ENOSPC 5
+#define MINIVSFS_EDIRFULL 6
+#define MINIVSFS_ENAMETOOLONG 7
+#define MINIVSFS_EFBIG 8
+#define MINIVSFS_ENOENT 9
+#define MINIVSFS_EINVAL 10
+#define MINIVSFS_ESTALE 11
+
+typedef struct minivsfs minivsfs_t;
+
+uint32_t minivsfs_crc32(const void *data, size_t n);
+uint32_t superblock_crc_finalize(superblock_t *sb);
+void inode_crc_finalize(inode_t *ino);
+void dirent_checksum_finalize(dirent64_t *de);
+
+// loads the whole image into memory; older images are upgraded to FS_VERSION
+int minivsfs_open(const char *path, minivsfs_t **out);
+
+// builds a fresh image in memory holding only the root directory; groups == 1 is the
+// flat layout. Nothing touches disk until minivsfs_commit
+int minivsfs_format(uint64_t size_kib, uint64_t inode_count, uint32_t groups, minivsfs_t **out);
+
+// claims an inode and nblocks data blocks near it without linking them anywhere
+int minivsfs_alloc(minivsfs_t *fs, uint64_t nblocks, uint64_t *ino_out, uint32_t *blocks);
+
+// adds a regular file to the root directory
+int minivsfs_add(minivsfs_t *fs, const char *name, const void *data, uint64_t size, uint64_t *ino_out);
+
+int minivsfs_lookup(minivsfs_t *fs, const char *name, uint64_t *ino_out);
+
+// unlinks a regular file and frees its inode and blocks; the blocks are zeroed, and
+// like every free data block they are left as holes in the file written by commit
+int minivsfs_remove(minivsfs_t *fs, const char *name);
+
+// overwrites a regular file, keeping its inode and as many of its blocks as still fit
+int minivsfs_replace(minivsfs_t *fs, const char *name, const void *data, uint64_t size, uint64_t *ino_out);
+int minivsfs_stat(minivsfs_t *fs, uint64_t ino, inode_t *out);
+
+// copies up to size bytes from offset; returns the byte count or a negative error
+int64_t minivsfs_read(minivsfs_t *fs, uint64_t ino, void *buf, uint64_t size, uint64_t offset);
+
+// fsck: returns the number of inconsistencies found (0 = clean) or a negative error;
+// with repair set, free counters and the free-run summary are rebuilt from the bitmaps.
+// No add may be in flight
+int minivsfs_check(minivsfs_t *fs, int repair);
+
+// packs every file into one contiguous run, files laid end to end from the start of
+// their inode's group; with truncate set the free tail of the image is dropped.
+// Returns -MINIVSFS_EBADFS, leaving the image untouched, if blocks are shared or out of
+// range. No add may be in flight
+int minivsfs_defrag(minivsfs_t *fs, int truncate, uint64_t *moved_out);
+
+// grows or shrinks the image to size_kib and the inode tables to hold inode_count
+// (0 keeps either). A flat image stays flat; a grouped one gains or drops whole groups,
+// and keeps its group count, short last group included, when the size stays.
+// Only blocks that end up inside an inode table or past the new end are moved.
+// Inode tables only grow, and shrinking fails with -MINIVSFS_ENOSPC if it would cut
+// off a live inode or there is no room left for the displaced blocks. No add may be in flight
+int minivsfs_resize(minivsfs_t *fs, uint64_t size_kib, uint64_t inode_count, uint64_t *moved_out);
+
+typedef struct
+{
+    uint64_t data_blocks; // blocks carried in the delta
+    uint64_t zero_blocks; // blocks that became zeros
+    uint64_t extents;
+    uint64_t delta_bytes;
+} minivsfs_delta_info_t;
+
+// writes the blocks that differ between base and target to delta_path; every block is
+// compared byte for byte, by jobs threads
+int minivsfs_diff(minivsfs_t *base, minivsfs_t *target, int jobs, const char *delta_path, minivsfs_delta_info_t *info);
+
+// patches the image file in place, touching only the blocks in the delta. Fails with
+// -MINIVSFS_ESTALE, before writing anything, unless the image is the delta's base
+int minivsfs_apply(const char *image_path, const char *delta_path, minivsfs_delta_info_t *info);
+
+// current superblock with live free counters folded in; no add may be in flight
+const superblock_t *minivsfs_superblock(minivsfs_t *fs);
+
+// folds the allocation state into the superblock and writes the image to path
+// (the opened path when NULL), skipping free data blocks so the file stays sparse;
+// no add may be in flight
+int minivsfs_commit(minivsfs_t *fs, const char *path);
+
+void minivsfs_close(minivsfs_t *fs);
+const char *minivsfs_strerror(int err);
+
+// ---- instrumentation ----
+// Off by default; once enabled, phases are timed and hot-path counters are kept
+// process-wide. With trace set, every phase is also logged to stderr as it ends
+#define MINIVSFS_PHASES 11 // open, format, add, remove, replace, check, commit, defrag, resize, diff, apply
+
+typedef struct
+{
+    uint64_t phase_ns[MINIVSFS_PHASES];
+    uint64_t phase_calls[MINIVSFS_PHASES];
+    uint64_t bitmap_bits_scanned;
+    uint64_t crc_bytes;
+    uint64_t data_bytes_copied;
+    uint64_t syscalls;       // image and delta file I/O calls the library makes
+    uint64_t peak_rss_kib;
+} minivsfs_stats_t;
+
+void minivsfs_stats_enable(int trace);
+void minivsfs_stats_get(minivsfs_stats_t *out);
+void minivsfs_stats_report(FILE *out, int json);
+
+// ---- command-line helpers shared by the mkfs_* tools ----
+typedef enum
+{
+    MINIVSFS_OPT_STR,      // char *
+    MINIVSFS_OPT_U64,      // uint64_t
+    MINIVSFS_OPT_STR_LIST, // char *[], appended at *count
+    MINIVSFS_OPT_FLAG      // int set to 1, takes no value
+} minivsfs_opt_kind_t;
+
+typedef struct
+{
+    const char *name;
+    minivsfs_opt_kind_t kind;
+    void *dest;
+    int *count;
+} minivsfs_opt_t;
+
+// fills dests from "--name value" pairs; opts ends with a NULL name. Validation of the
+// values is left to the caller, except for --stats human|json and --trace: every tool
+// accepts those, and they are checked here and switch the instrumentation on. The
+// --stats report is printed to stdout when the process exits, whatever the outcome
+int minivsfs_parse_opts(int argc, char *argv[], const minivsfs_opt_t *opts);
+
+#define MINIVSFS_STATS_USAGE "[--stats human|json] [--trace]"
+
+#endif
@@ -0,0 +1,471 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra -pthread minivsfs_bench.c minivsfs.c -o minivsfs_bench
+#define _FILE_OFFSET_BITS 64
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "minivsfs.h"
+
+#define ROOT_FILES_MAX (BS / sizeof(dirent64_t) - 2) // root dir is one block, minus . and ..
+#define TINY_FILE 100u
+#define LARGE_FILE (DIRECT_MAX * BS)
+
+typedef struct
+{
+    const char *name;
+    uint64_t ops;
+    uint64_t bytes; // payload moved, for MB/s
+    double seconds;
+} bench_result_t;
+
+static char g_image_path[4096];
+static uint8_t g_payload[LARGE_FILE];
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what, int rc)
+{
+    fprintf(stderr, "Error: %s: %s\n", what, minivsfs_strerror(rc));
+    exit(1);
+}
+
+static void file_name(char *buf, size_t n, uint64_t i)
+{
+    snprintf(buf, n, "bench_%06lu", i);
+}
+
+// fills the root directory of a fresh flat image with files of the given size
+static minivsfs_t *filled_image(uint64_t file_size)
+{
+    minivsfs_t *fs;
+    int rc = minivsfs_format(4096, 512, 1, &fs);
+    if (rc != MINIVSFS_OK)
+        die("format", rc);
+    for (uint64_t i = 0; i < ROOT_FILES_MAX; i++)
+    {
+        char name[32];
+        file_name(name, sizeof(name), i);
+        rc = minivsfs_add(fs, name, g_payload, file_size, NULL);
+        if (rc != MINIVSFS_OK)
+            die("add", rc);
+    }
+    return fs;
+}
+
+// mkfs_builder: format + write a whole image
+static bench_result_t bench_format(const char *name, uint64_t size_kib, uint64_t inodes, uint32_t groups,
+                                   int rounds)
+{
+    bench_result_t r = {name, 0, 0, 0};
+    double t0 = now_seconds();
+    for (int i = 0; i < rounds; i++)
+    {
+        minivsfs_t *fs;
+        int rc = minivsfs_format(size_kib, inodes, groups, &fs);
+        if (rc == MINIVSFS_OK)
+            rc = minivsfs_commit(fs, g_image_path);
+        if (rc != MINIVSFS_OK)
+            die("format", rc);
+        minivsfs_close(fs);
+        r.ops++;
+        r.bytes += size_kib * 1024;
+    }
+    r.seconds = now_seconds() - t0;
+    return r;
+}
+
+// mkfs_adder run once per file: open + add + commit of the whole image each time
+static bench_result_t bench_add_per_file(int rounds)
+{
+    bench_result_t r = {"add_per_file_tiny", 0, 0, 0};
+    minivsfs_t *fs;
+    int rc = minivsfs_format(4096, 512, 1, &fs);
+    if (rc != MINIVSFS_OK || (rc = minivsfs_commit(fs, g_image_path)) != MINIVSFS_OK)
+        die("format", rc);
+    minivsfs_close(fs);
+
+    double t0 = now_seconds();
+    for (int round = 0; round < rounds; round++)
+    {
+        for (uint64_t i = 0; i < ROOT_FILES_MAX / 8; i++)
+        {
+            char name[32];
+            file_name(name, sizeof(name), r.ops);
+            if ((rc = minivsfs_open(g_image_path, &fs)) != MINIVSFS_OK ||
+                (rc = minivsfs_add(fs, name, g_payload, TINY_FILE, NULL)) != MINIVSFS_OK ||
+                (rc = minivsfs_commit(fs, NULL)) != MINIVSFS_OK)
+                die("add", rc);
+            minivsfs_close(fs);
+            r.ops++;
+            r.bytes += TINY_FILE;
+        }
+        // start over before the root directory fills up
+        if ((rc = minivsfs_format(4096, 512, 1, &fs)) != MINIVSFS_OK ||
+            (rc = minivsfs_commit(fs, g_image_path)) != MINIVSFS_OK)
+            die("format", rc);
+        minivsfs_close(fs);
+    }
+    r.seconds = now_seconds() - t0;
+    return r;
+}
+
+// batched adds into one in-memory image, committed once per image
+static bench_result_t bench_add_batched(const char *name, uint64_t file_size, int rounds)
+{
+    bench_result_t r = {name, 0, 0, 0};
+    double t0 = now_seconds();
+    for (int round = 0; round < rounds; round++)
+    {
+        minivsfs_t *fs = filled_image(file_size);
+        int rc = minivsfs_commit(fs, g_image_path);
+        if (rc != MINIVSFS_OK)
+            die("commit", rc);
+        minivsfs_close(fs);
+        r.ops += ROOT_FILES_MAX;
+        r.bytes += ROOT_FILES_MAX * file_size;
+    }
+    r.seconds = now_seconds() - t0;
+    return r;
+}
+
+// every other data block in use, so multi-block files cannot get a contiguous run
+static minivsfs_t *fragmented_image(void)
+{
+    minivsfs_t *fs;
+    int rc = minivsfs_format(4096, 512, 1, &fs);
+    if (rc != MINIVSFS_OK || (rc = minivsfs_commit(fs, g_image_path)) != MINIVSFS_OK)
+        die("format", rc);
+    const superblock_t *sb = minivsfs_superblock(fs);
+    uint64_t bitmap_offset = sb->data_bitmap_start * BS;
+    uint64_t bitmap_bytes = (sb->data_region_blocks + 7) / 8;
+    minivsfs_close(fs);
+
+    uint8_t pattern[BS];
+    memset(pattern, 0x55, sizeof(pattern));
+    FILE *f = fopen(g_image_path, "r+b");
+    if (!f || fseek(f, bitmap_offset, SEEK_SET) != 0 || fwrite(pattern, 1, bitmap_bytes, f) != bitmap_bytes)
+        die("fragment", -MINIVSFS_EIO);
+    fclose(f);
+
+    if ((rc = minivsfs_open(g_image_path, &fs)) != MINIVSFS_OK)
+        die("open", rc);
+    minivsfs_check(fs, 1); // recount the summary; the pattern blocks show up as leaks
+    return fs;
+}
+
+static bench_result_t bench_add_fragmented(int rounds)
+{
+    bench_result_t r = {"add_batched_fragmented", 0, 0, 0};
+    double elapsed = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        minivsfs_t *fs = fragmented_image();
+        double t0 = now_seconds();
+        for (uint64_t i = 0; i < ROOT_FILES_MAX; i++)
+        {
+            char name[32];
+            file_name(name, sizeof(name), i);
+            int rc = minivsfs_add(fs, name, g_payload, 4 * BS, NULL);
+            if (rc == -MINIVSFS_ENOSPC)
+                break;
+            if (rc != MINIVSFS_OK)
+                die("add", rc);
+            r.ops++;
+            r.bytes += 4 * BS;
+        }
+        elapsed += now_seconds() - t0;
+        minivsfs_close(fs);
+    }
+    r.seconds = elapsed;
+    return r;
+}
+
+// allocation alone (inode + blocks, no data copy or dirent) until the image is exhausted
+static bench_result_t bench_alloc(const char *name, uint64_t nblocks, int rounds)
+{
+    bench_result_t r = {name, 0, 0, 0};
+    double elapsed = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        minivsfs_t *fs;
+        int rc = minivsfs_format(262144, 4096, 8, &fs);
+        if (rc != MINIVSFS_OK)
+            die("format", rc);
+
+        double t0 = now_seconds();
+        uint32_t blocks[DIRECT_MAX];
+        uint64_t ino;
+        while ((rc = minivsfs_alloc(fs, nblocks, &ino, blocks)) == MINIVSFS_OK)
+        {
+            r.ops++;
+            r.bytes += nblocks * BS;
+        }
+        elapsed += now_seconds() - t0;
+        if (rc != -MINIVSFS_ENOINODE && rc != -MINIVSFS_ENOSPC)
+            die("alloc", rc);
+        minivsfs_close(fs);
+    }
+    r.seconds = elapsed;
+    return r;
+}
+
+// "does it fit" on a full image must be answered from the counters alone
+static bench_result_t bench_add_full(int rounds)
+{
+    bench_result_t r = {"add_reject_full", 0, 0, 0};
+    minivsfs_t *fs = filled_image(TINY_FILE);
+    uint32_t blocks[DIRECT_MAX];
+    uint64_t ino;
+    while (minivsfs_alloc(fs, 1, &ino, blocks) == MINIVSFS_OK)
+        ;
+
+    double t0 = now_seconds();
+    for (int i = 0; i < rounds * 100000; i++)
+    {
+        if (minivsfs_add(fs, "overflow", g_payload, TINY_FILE, NULL) == MINIVSFS_OK)
+            die("add on a full image succeeded", 0);
+        r.ops++;
+    }
+    r.seconds = now_seconds() - t0;
+    minivsfs_close(fs);
+    return r;
+}
+
+static bench_result_t bench_lookup_read(int rounds)
+{
+    bench_result_t r = {"lookup_read_tiny", 0, 0, 0};
+    minivsfs_t *fs = filled_image(TINY_FILE);
+    uint8_t buf[TINY_FILE];
+
+    double t0 = now_seconds();
+    for (int round = 0; round < rounds * 100; round++)
+    {
+        for (uint64_t i = 0; i < ROOT_FILES_MAX; i++)
+        {
+            char name[32];
+            uint64_t ino;
+            file_name(name, sizeof(name), i);
+            int rc = minivsfs_lookup(fs, name, &ino);
+            if (rc != MINIVSFS_OK)
+                die("lookup", rc);
+            if (minivsfs_read(fs, ino, buf, sizeof(buf), 0) != TINY_FILE)
+                die("read", -MINIVSFS_EIO);
+            r.ops++;
+            r.bytes += TINY_FILE;
+        }
+    }
+    r.seconds = now_seconds() - t0;
+    minivsfs_close(fs);
+    return r;
+}
+
+static bench_result_t bench_check(int rounds)
+{
+    bench_result_t r = {"check_full_image", 0, 0, 0};
+    minivsfs_t *fs = filled_image(LARGE_FILE / 2);
+    uint64_t image_bytes = minivsfs_superblock(fs)->total_blocks * BS;
+
+    double t0 = now_seconds();
+    for (int i = 0; i < rounds * 10; i++)
+    {
+        int problems = minivsfs_check(fs, 0);
+        if (problems != 0)
+            die("check found problems", problems < 0 ? problems : 0);
+        r.ops++;
+        r.bytes += image_bytes;
+    }
+    r.seconds = now_seconds() - t0;
+    minivsfs_close(fs);
+    return r;
+}
+
+// every other file of a full image removed and the gaps refilled with larger files,
+// which no longer fit in one run
+static minivsfs_t *churned_image(void)
+{
+    minivsfs_t *fs = filled_image(3 * BS);
+    for (uint64_t i = 0; i < ROOT_FILES_MAX; i += 2)
+    {
+        char name[32];
+        file_name(name, sizeof(name), i);
+        int rc = minivsfs_remove(fs, name);
+        if (rc == MINIVSFS_OK)
+            rc = minivsfs_add(fs, name, g_payload, 5 * BS, NULL);
+        if (rc != MINIVSFS_OK)
+            die("churn", rc);
+    }
+    return fs;
+}
+
+static bench_result_t bench_defrag(int rounds)
+{
+    bench_result_t r = {"defrag_churned", 0, 0, 0};
+    double elapsed = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        minivsfs_t *fs = churned_image();
+        uint64_t moved;
+        double t0 = now_seconds();
+        int rc = minivsfs_defrag(fs, 1, &moved);
+        elapsed += now_seconds() - t0;
+        if (rc != MINIVSFS_OK)
+            die("defrag", rc);
+        r.ops++;
+        r.bytes += moved * BS;
+        minivsfs_close(fs);
+    }
+    r.seconds = elapsed;
+    return r;
+}
+
+// doubles the inode table of a full image, which displaces the blocks behind it
+static bench_result_t bench_resize(int rounds)
+{
+    bench_result_t r = {"resize_grow_inodes", 0, 0, 0};
+    double elapsed = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        minivsfs_t *fs = filled_image(3 * BS);
+        uint64_t moved;
+        double t0 = now_seconds();
+        int rc = minivsfs_resize(fs, 8192, 1024, &moved);
+        elapsed += now_seconds() - t0;
+        if (rc != MINIVSFS_OK)
+            die("resize", rc);
+        r.ops++;
+        r.bytes += moved * BS;
+        minivsfs_close(fs);
+    }
+    r.seconds = elapsed;
+    return r;
+}
+
+// one file replaced in a full image; every block is compared, few end up in the delta
+static bench_result_t bench_diff(int rounds)
+{
+    bench_result_t r = {"diff_one_file_changed", 0, 0, 0};
+    char delta_path[4096 + 8];
+    snprintf(delta_path, sizeof(delta_path), "%s.delta", g_image_path);
+
+    minivsfs_t *base = filled_image(3 * BS), *target;
+    int rc = minivsfs_commit(base, g_image_path);
+    if (rc != MINIVSFS_OK || (rc = minivsfs_open(g_image_path, &target)) != MINIVSFS_OK)
+        die("open", rc);
+    char name[32];
+    file_name(name, sizeof(name), 7);
+    if ((rc = minivsfs_replace(target, name, g_payload + 1, 3 * BS, NULL)) != MINIVSFS_OK)
+        die("replace", rc);
+    uint64_t image_bytes = minivsfs_superblock(target)->total_blocks * BS;
+
+    double t0 = now_seconds();
+    for (int i = 0; i < rounds * 10; i++)
+    {
+        minivsfs_delta_info_t info;
+        if ((rc = minivsfs_diff(base, target, 1, delta_path, &info)) != MINIVSFS_OK)
+            die("diff", rc);
+        r.ops++;
+        r.bytes += image_bytes;
+    }
+    r.seconds = now_seconds() - t0;
+    unlink(delta_path);
+    minivsfs_close(base);
+    minivsfs_close(target);
+    return r;
+}
+
+static bench_result_t bench_crc32(int rounds)
+{
+    bench_result_t r = {"crc32", 0, 0, 0};
+    static uint8_t buf[4u << 20];
+    memset(buf, 0xA5, sizeof(buf));
+
+    volatile uint32_t sink = 0;
+    double t0 = now_seconds();
+    for (int i = 0; i < rounds * 4; i++)
+    {
+        sink ^= minivsfs_crc32(buf, sizeof(buf));
+        r.ops++;
+        r.bytes += sizeof(buf);
+    }
+    r.seconds = now_seconds() - t0;
+    (void)sink;
+    return r;
+}
+
+static void report_json(FILE *out, const bench_result_t *results, int n, int rounds)
+{
+    fprintf(out, "{\n  \"rounds\": %d,\n  \"benchmarks\": [\n", rounds);
+    for (int i = 0; i < n; i++)
+    {
+        const bench_result_t *r = &results[i];
+        double secs = r->seconds > 0 ? r->seconds : 1e-9;
+        fprintf(out,
+                "    {\"name\": \"%s\", \"ops\": %lu, \"seconds\": %.6f, \"ops_per_sec\": %.1f, "
+                "\"mb_per_sec\": %.2f}%s\n",
+                r->name, r->ops, r->seconds, r->ops / secs, r->bytes / secs / (1024.0 * 1024.0),
+                i + 1 < n ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t rounds = 5;
+    char *out_file = NULL;
+    char *dir = "/tmp";
+
+    const minivsfs_opt_t opts[] = {
+        {"--rounds", MINIVSFS_OPT_U64, &rounds, NULL},
+        {"--output", MINIVSFS_OPT_STR, &out_file, NULL},
+        {"--dir", MINIVSFS_OPT_STR, &dir, NULL},
+        {NULL, 0, NULL, NULL},
+    };
+    if (minivsfs_parse_opts(argc, argv, opts) != 0 || rounds < 1 || rounds > 100000)
+    {
+        fprintf(stderr, "Usage: %s [--rounds <1..100000>] [--output <file.json>] [--dir <scratch dir>]\n", argv[0]);
+        return 1;
+    }
+
+    snprintf(g_image_path, sizeof(g_image_path), "%s/minivsfs_bench_%ld.img", dir, (long)getpid());
+    for (size_t i = 0; i < sizeof(g_payload); i++)
+        g_payload[i] = (uint8_t)(i * 131 + 7);
+
+    int n = (int)rounds;
+    bench_result_t results[] = {
+        bench_format("format_flat_4m", 4096, 512, 1, n),
+        bench_format("format_grouped_64m", 65536, 2048, 8, n),
+        bench_add_per_file(n),
+        bench_add_batched("add_batched_tiny", TINY_FILE, n),
+        bench_add_batched("add_batched_large", LARGE_FILE, n),
+        bench_add_fragmented(n),
+        bench_add_full(n),
+        bench_alloc("alloc_1_block", 1, n),
+        bench_alloc("alloc_12_blocks", DIRECT_MAX, n),
+        bench_lookup_read(n),
+        bench_check(n),
+        bench_defrag(n),
+        bench_resize(n),
+        bench_diff(n),
+        bench_crc32(n),
+    };
+    unlink(g_image_path);
+
+    FILE *out = out_file ? fopen(out_file, "w") : stdout;
+    if (!out)
+    {
+        perror("Error opening output file");
+        return 1;
+    }
+    report_json(out, results, sizeof(results) / sizeof(results[0]), n);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
@@ -0,0 +1,63 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra -pthread mkfs_apply.c minivsfs.c -o mkfs_apply
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minivsfs.h"
+
+int parse_args(int argc, char *argv[], char **image_file, char **delta_file)
+{
+    *image_file = NULL;
+    *delta_file = NULL;
+
+    const minivsfs_opt_t opts[] = {
+        {"--image", MINIVSFS_OPT_STR, image_file, NULL},
+        {"--delta", MINIVSFS_OPT_STR, delta_file, NULL},
+        {NULL, 0, NULL, NULL},
+    };
+    if (minivsfs_parse_opts(argc, argv, opts) != 0)
+        return -1;
+
+    if (!*image_file)
+    {
+        fprintf(stderr, "Error: --image parameter required\n");
+        return -1;
+    }
+    if (!*delta_file)
+    {
+        fprintf(stderr, "Error: --delta parameter required\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char *image_file, *delta_file;
+
+    if (parse_args(argc, argv, &image_file, &delta_file) != 0)
+    {
+        fprintf(stderr, "Usage: %s --image <file> --delta <file> " MINIVSFS_STATS_USAGE "\n", argv[0]);
+        return 1;
+    }
+
+    minivsfs_delta_info_t info;
+    int rc = minivsfs_apply(image_file, delta_file, &info);
+    if (rc == -MINIVSFS_EBADFS && info.extents == 0)
+    {
+        fprintf(stderr, "Error: Delta '%s' is damaged or not a MiniVSFS delta\n", delta_file);
+        return 1;
+    }
+    if (rc != MINIVSFS_OK)
+    {
+        fprintf(stderr, "Error: %s\n", minivsfs_strerror(rc));
+        return 1;
+    }
+
+    printf("Delta '%s' applied to MiniVSFS image '%s' successfully\n", delta_file, image_file);
+    printf("Wrote %lu blocks, zeroed %lu blocks in %lu extents\n", info.data_blocks, info.zero_blocks,
+           info.extents);
+    return 0;
+}
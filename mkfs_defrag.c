@@ -0,0 +1,114 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra -pthread mkfs_defrag.c minivsfs.c -o mkfs_defrag
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minivsfs.h"
+
+int parse_args(int argc, char *argv[], char **input_file, char **output_file, int *truncate)
+{
+    *input_file = NULL;
+    *output_file = NULL;
+    *truncate = 0;
+
+    const minivsfs_opt_t opts[] = {
+        {"--input", MINIVSFS_OPT_STR, input_file, NULL},
+        {"--output", MINIVSFS_OPT_STR, output_file, NULL},
+        {"--truncate", MINIVSFS_OPT_FLAG, truncate, NULL},
+        {NULL, 0, NULL, NULL},
+    };
+    if (minivsfs_parse_opts(argc, argv, opts) != 0)
+        return -1;
+
+    if (!*input_file)
+    {
+        fprintf(stderr, "Error: --input parameter required\n");
+        return -1;
+    }
+    if (!*output_file)
+    {
+        fprintf(stderr, "Error: --output parameter required\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// files whose data is not one contiguous run
+uint64_t count_fragmented_files(minivsfs_t *fs)
+{
+    uint64_t fragmented = 0;
+    for (uint64_t ino = 1; ino <= minivsfs_superblock(fs)->inode_count; ino++)
+    {
+        inode_t inode;
+        if (minivsfs_stat(fs, ino, &inode) != MINIVSFS_OK || inode.mode != MODE_FILE)
+            continue;
+        uint64_t nblocks = (inode.size_bytes + BS - 1) / BS;
+        for (uint64_t b = 1; b < nblocks && b < DIRECT_MAX; b++)
+        {
+            if (inode.direct[b] != inode.direct[b - 1] + 1)
+            {
+                fragmented++;
+                break;
+            }
+        }
+    }
+    return fragmented;
+}
+
+int main(int argc, char *argv[])
+{
+    char *input_file, *output_file;
+    int truncate;
+
+    if (parse_args(argc, argv, &input_file, &output_file, &truncate) != 0)
+    {
+        fprintf(stderr, "Usage: %s --input <file> --output <file> [--truncate] " MINIVSFS_STATS_USAGE "\n",
+                argv[0]);
+        return 1;
+    }
+
+    minivsfs_t *fs;
+    int rc = minivsfs_open(input_file, &fs);
+    if (rc != MINIVSFS_OK)
+    {
+        fprintf(stderr, "Error: %s\n", minivsfs_strerror(rc));
+        return 1;
+    }
+
+    uint64_t blocks_before = minivsfs_superblock(fs)->total_blocks;
+    uint64_t fragmented_before = count_fragmented_files(fs);
+
+    uint64_t moved;
+    rc = minivsfs_defrag(fs, truncate, &moved);
+    if (rc == -MINIVSFS_EBADFS)
+    {
+        fprintf(stderr, "Error: Image has shared or out-of-range blocks; repair it first\n");
+        minivsfs_close(fs);
+        return 1;
+    }
+    if (rc != MINIVSFS_OK)
+    {
+        fprintf(stderr, "Error: %s\n", minivsfs_strerror(rc));
+        minivsfs_close(fs);
+        return 1;
+    }
+
+    rc = minivsfs_commit(fs, output_file);
+    if (rc != MINIVSFS_OK)
+    {
+        perror("Error writing output image");
+        minivsfs_close(fs);
+        return 1;
+    }
+
+    printf("MiniVSFS image '%s' compacted into '%s'\n", input_file, output_file);
+    printf("Moved %lu data blocks\n", moved);
+    printf("Fragmented files: %lu -> %lu\n", fragmented_before, count_fragmented_files(fs));
+    if (truncate)
+        printf("Total size: %lu -> %lu blocks\n", blocks_before, minivsfs_superblock(fs)->total_blocks);
+
+    minivsfs_close(fs);
+    return 0;
+}
@@ -0,0 +1,95 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra -pthread mkfs_diff.c minivsfs.c -o mkfs_diff
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minivsfs.h"
+
+#define JOBS_MAX 64
+
+int parse_args(int argc, char *argv[], char **base_file, char **target_file, char **delta_file, uint64_t *jobs)
+{
+    *base_file = NULL;
+    *target_file = NULL;
+    *delta_file = NULL;
+    *jobs = 1;
+
+    const minivsfs_opt_t opts[] = {
+        {"--old", MINIVSFS_OPT_STR, base_file, NULL},
+        {"--new", MINIVSFS_OPT_STR, target_file, NULL},
+        {"--output", MINIVSFS_OPT_STR, delta_file, NULL},
+        {"--jobs", MINIVSFS_OPT_U64, jobs, NULL},
+        {NULL, 0, NULL, NULL},
+    };
+    if (minivsfs_parse_opts(argc, argv, opts) != 0)
+        return -1;
+
+    if (!*base_file)
+    {
+        fprintf(stderr, "Error: --old parameter required\n");
+        return -1;
+    }
+    if (!*target_file)
+    {
+        fprintf(stderr, "Error: --new parameter required\n");
+        return -1;
+    }
+    if (!*delta_file)
+    {
+        fprintf(stderr, "Error: --output parameter required\n");
+        return -1;
+    }
+    if (*jobs < 1 || *jobs > JOBS_MAX)
+    {
+        fprintf(stderr, "Error: --jobs must be between 1 and %d\n", JOBS_MAX);
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char *base_file, *target_file, *delta_file;
+    uint64_t jobs;
+
+    if (parse_args(argc, argv, &base_file, &target_file, &delta_file, &jobs) != 0)
+    {
+        fprintf(stderr,
+                "Usage: %s --old <file> --new <file> --output <delta> [--jobs <n>] " MINIVSFS_STATS_USAGE "\n",
+                argv[0]);
+        return 1;
+    }
+
+    minivsfs_t *base, *target;
+    int rc = minivsfs_open(base_file, &base);
+    if (rc != MINIVSFS_OK)
+    {
+        fprintf(stderr, "Error: %s: %s\n", base_file, minivsfs_strerror(rc));
+        return 1;
+    }
+    rc = minivsfs_open(target_file, &target);
+    if (rc != MINIVSFS_OK)
+    {
+        fprintf(stderr, "Error: %s: %s\n", target_file, minivsfs_strerror(rc));
+        minivsfs_close(base);
+        return 1;
+    }
+
+    minivsfs_delta_info_t info;
+    rc = minivsfs_diff(base, target, (int)jobs, delta_file, &info);
+    minivsfs_close(base);
+    minivsfs_close(target);
+    if (rc != MINIVSFS_OK)
+    {
+        fprintf(stderr, "Error: %s\n", minivsfs_strerror(rc));
+        return 1;
+    }
+
+    printf("Delta '%s' from '%s' to '%s' written successfully\n", delta_file, base_file, target_file);
+    printf("Changed blocks: %lu (%lu zeroed) in %lu extents\n", info.data_blocks + info.zero_blocks,
+           info.zero_blocks, info.extents);
+    printf("Delta size: %lu bytes\n", info.delta_bytes);
+    return 0;
+}
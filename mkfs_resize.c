@@ -0,0 +1,117 @@
+// Build: gcc -O2 -std=c17 -Wall -Wextra -pthread mkfs_resize.c minivsfs.c -o mkfs_resize
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minivsfs.h"
+
+int parse_args(int argc, char *argv[], char **input_file, char **output_file, uint64_t *size_kib,
+               uint64_t *inodes)
+{
+    *input_file = NULL;
+    *output_file = NULL;
+    *size_kib = 0;
+    *inodes = 0;
+
+    const minivsfs_opt_t opts[] = {
+        {"--input", MINIVSFS_OPT_STR, input_file, NULL},
+        {"--output", MINIVSFS_OPT_STR, output_file, NULL},
+        {"--size-kib", MINIVSFS_OPT_U64, size_kib, NULL},
+        {"--inodes", MINIVSFS_OPT_U64, inodes, NULL},
+        {NULL, 0, NULL, NULL},
+    };
+    if (minivsfs_parse_opts(argc, argv, opts) != 0)
+        return -1;
+
+    if (!*input_file)
+    {
+        fprintf(stderr, "Error: --input parameter required\n");
+        return -1;
+    }
+    if (!*output_file)
+    {
+        fprintf(stderr, "Error: --output parameter required\n");
+        return -1;
+    }
+    if (*size_kib == 0 && *inodes == 0)
+    {
+        fprintf(stderr, "Error: --size-kib or --inodes parameter required\n");
+        return -1;
+    }
+    if (*size_kib % 4 != 0 || *size_kib > 1048576)
+    {
+        fprintf(stderr, "Error: --size-kib must be a multiple of 4 and at most 1048576\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char *input_file, *output_file;
+    uint64_t size_kib, inode_count;
+
+    if (parse_args(argc, argv, &input_file, &output_file, &size_kib, &inode_count) != 0)
+    {
+        fprintf(stderr,
+                "Usage: %s --input <file> --output <file> [--size-kib <n>] [--inodes <n>] "
+                MINIVSFS_STATS_USAGE "\n",
+                argv[0]);
+        return 1;
+    }
+
+    minivsfs_t *fs;
+    int rc = minivsfs_open(input_file, &fs);
+    if (rc != MINIVSFS_OK)
+    {
+        fprintf(stderr, "Error: %s\n", minivsfs_strerror(rc));
+        return 1;
+    }
+
+    superblock_t before = *minivsfs_superblock(fs);
+    uint64_t moved;
+    rc = minivsfs_resize(fs, size_kib, inode_count, &moved);
+    if (rc == -MINIVSFS_EINVAL)
+    {
+        fprintf(stderr, "Error: Invalid target geometry (every group needs room for its inode table and a "
+                        "data block, and a group has at most %u data blocks and %u inodes)\n",
+                BS * 8, BS * 8);
+        minivsfs_close(fs);
+        return 1;
+    }
+    if (rc == -MINIVSFS_ENOSPC)
+    {
+        fprintf(stderr, "Error: Files do not fit in the resized image\n");
+        minivsfs_close(fs);
+        return 1;
+    }
+    if (rc != MINIVSFS_OK)
+    {
+        fprintf(stderr, "Error: %s\n", minivsfs_strerror(rc));
+        minivsfs_close(fs);
+        return 1;
+    }
+
+    rc = minivsfs_commit(fs, output_file);
+    if (rc != MINIVSFS_OK)
+    {
+        perror("Error writing output image");
+        minivsfs_close(fs);
+        return 1;
+    }
+
+    const superblock_t *sb = minivsfs_superblock(fs);
+    printf("MiniVSFS image '%s' resized into '%s'\n", input_file, output_file);
+    printf("Total size: %lu -> %lu KB (%lu -> %lu blocks)\n", before.total_blocks * BS / 1024,
+           sb->total_blocks * BS / 1024, before.total_blocks, sb->total_blocks);
+    printf("Inodes: %lu -> %lu\n", before.inode_count, sb->inode_count);
+    if (sb->group_count > 1 || before.group_count > 1)
+        printf("Block groups: %u -> %u\n", before.group_count, sb->group_count);
+    printf("Moved %lu data blocks\n", moved);
+    printf("Data blocks available: %lu\n", sb->free_blocks_count);
+
+    minivsfs_close(fs);
+    return 0;
+}